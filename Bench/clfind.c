@@ -0,0 +1,50 @@
+/***************************************************************************
+*                 OpenCL FindMatch Compiled for the Host
+*
+*   File    : clfind.c
+*   Purpose : Build the FindMatch used by the EncodeLZSS kernel in
+*             OpenCL/encode.cl as host code, so the match search of the
+*             device path can be timed next to the Serial searches.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include "clhost.h"
+
+/* keep the kernel's names away from the Serial library's */
+#define FindMatch KernelFindMatch
+#define EncodeLZSS KernelEncodeLZSS
+#include "encode.cl"
+#undef FindMatch
+#undef EncodeLZSS
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : ClFindMatch
+*   Description: Calls the kernel's FindMatch on a host copy of a window
+*                and lookahead.
+*   Parameters : windowHead - head of sliding window
+*                uncodedHead - head of uncoded lookahead buffer
+*                windowSize - size of the sliding window
+*                window - windowSize byte sliding window
+*                lookahead - MAX_CODED byte uncoded lookahead
+*                offset - receives the offset of the match
+*   Effects    : None
+*   Returned   : Length of the longest match
+****************************************************************************/
+unsigned int ClFindMatch(unsigned int windowHead, unsigned int uncodedHead,
+    unsigned int windowSize, unsigned char *window, unsigned char *lookahead,
+    unsigned int *offset)
+{
+    encoded_string_t matchData;
+
+    matchData = KernelFindMatch(windowHead, uncodedHead, windowSize, window,
+        lookahead);
+    *offset = matchData.offset;
+    return matchData.length;
+}
@@ -0,0 +1,505 @@
+/***************************************************************************
+*                       FindMatch Microbenchmark
+*
+*   File    : fmbench.c
+*   Purpose : Time the LZSS match searches in isolation.  Sliding window
+*             and lookahead states are captured from a real encode of an
+*             input file and replayed in a tight loop against the Serial
+*             brute force and linked list searches and against the
+*             OpenCL kernel's FindMatch compiled for the host.
+*
+****************************************************************************
+*
+* Every implementation sees exactly the same states, so the numbers are
+* directly comparable and free of bitfile I/O.  The brute force search is
+* used while capturing, its match lengths are the reference that the other
+* searches are checked against.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+#include "lzlocal.h"
+#include "optlist.h"
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+typedef struct snapshot_t
+{
+    unsigned char window[WINDOW_SIZE];
+    unsigned char lookahead[MAX_CODED];
+    unsigned int windowHead;
+    unsigned int uncodedHead;
+    unsigned int length;        /* reference match length */
+} snapshot_t;
+
+typedef enum
+{
+    FM_BRUTE,
+    FM_LIST,
+    FM_KERNEL,
+    FM_NUM_IMPLS
+} impl_t;
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define NULL_INDEX      (WINDOW_SIZE + 1)   /* must match list.c */
+
+static const char *const implNames[FM_NUM_IMPLS] =
+{
+    "brute", "list", "kernel"
+};
+
+/***************************************************************************
+*                            GLOBAL VARIABLES
+***************************************************************************/
+/* state shared with the Serial searches, as in lzss.c */
+unsigned char slidingWindow[WINDOW_SIZE];
+unsigned char uncodedLookahead[MAX_CODED];
+
+/* list.c's index, built directly from a snapshot (see RestoreList) */
+extern unsigned int ListHeads[];
+extern unsigned int ListNext[];
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+/* brute.c and list.c compiled with renamed entry points (see Makefile) */
+int BruteInitializeSearchStructures(void);
+encoded_string_t BruteFindMatch(const unsigned int windowHead,
+    const unsigned int uncodedHead);
+int BruteReplaceChar(const unsigned int charIndex,
+    const unsigned char replacement);
+
+encoded_string_t ListFindMatch(const unsigned int windowHead,
+    const unsigned int uncodedHead);
+
+/* clfind.c */
+unsigned int ClFindMatch(unsigned int windowHead, unsigned int uncodedHead,
+    unsigned int windowSize, unsigned char *window, unsigned char *lookahead,
+    unsigned int *offset);
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : NowNs
+*   Description: Reads the monotonic clock.
+*   Parameters : None
+*   Effects    : None
+*   Returned   : Current time in nanoseconds
+****************************************************************************/
+static double NowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/****************************************************************************
+*   Function   : ReadCycles
+*   Description: Reads the time stamp counter where there is one.
+*   Parameters : None
+*   Effects    : None
+*   Returned   : Cycle count, or 0 if not available
+****************************************************************************/
+static unsigned long long ReadCycles(void)
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/****************************************************************************
+*   Function   : CaptureSnapshots
+*   Description: Runs the Serial encoder's parse over data using the brute
+*                force search and records the search state before every
+*                interval'th call of FindMatch.
+*   Parameters : data - input to parse
+*                size - number of bytes in data
+*                interval - capture every interval'th search
+*                snapshots - receives up to max states
+*                max - capacity of snapshots
+*   Effects    : Uses slidingWindow and uncodedLookahead
+*   Returned   : Number of states captured
+****************************************************************************/
+static size_t CaptureSnapshots(const unsigned char *data, size_t size,
+    size_t interval, snapshot_t *snapshots, size_t max)
+{
+    encoded_string_t matchData;
+    unsigned int windowHead, uncodedHead, len, i;
+    size_t read, calls, count;
+
+    memset(slidingWindow, ' ', WINDOW_SIZE);
+    BruteInitializeSearchStructures();
+    windowHead = 0;
+    uncodedHead = 0;
+    read = 0;
+    calls = 0;
+    count = 0;
+
+    for (len = 0; len < MAX_CODED && read < size; len++)
+    {
+        uncodedLookahead[len] = data[read++];
+    }
+
+    while (len > 0 && count < max)
+    {
+        snapshot_t *s = NULL;
+
+        if (calls++ % interval == 0)
+        {
+            s = &snapshots[count++];
+            memcpy(s->window, slidingWindow, WINDOW_SIZE);
+            memcpy(s->lookahead, uncodedLookahead, MAX_CODED);
+            s->windowHead = windowHead;
+            s->uncodedHead = uncodedHead;
+        }
+
+        matchData = BruteFindMatch(windowHead, uncodedHead);
+
+        if (s != NULL)
+        {
+            s->length = matchData.length;
+        }
+
+        if (matchData.length > len)
+        {
+            matchData.length = len;
+        }
+
+        if (matchData.length <= MAX_UNCODED)
+        {
+            matchData.length = 1;
+        }
+
+        for (i = 0; i < matchData.length; i++)
+        {
+            BruteReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
+
+            if (read < size)
+            {
+                uncodedLookahead[uncodedHead] = data[read++];
+            }
+            else
+            {
+                len--;
+            }
+
+            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
+            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
+        }
+    }
+
+    return count;
+}
+
+/****************************************************************************
+*   Function   : RestoreList
+*   Description: Rebuilds list.c's per-character lists for a snapshot.
+*                The encoder appends every replaced character to the end of
+*                its list, so each list holds window positions oldest
+*                first, starting at windowHead.  Building that directly
+*                takes one pass instead of replaying the whole window.
+*   Parameters : s - state to restore
+*   Effects    : slidingWindow, uncodedLookahead and the lists are set up
+*   Returned   : None
+****************************************************************************/
+static void RestoreList(const snapshot_t *s)
+{
+    unsigned int tails[UCHAR_MAX + 1];
+    unsigned int i, pos;
+
+    memcpy(slidingWindow, s->window, WINDOW_SIZE);
+    memcpy(uncodedLookahead, s->lookahead, MAX_CODED);
+
+    for (i = 0; i <= UCHAR_MAX; i++)
+    {
+        ListHeads[i] = NULL_INDEX;
+    }
+
+    for (i = 0; i < WINDOW_SIZE; i++)
+    {
+        unsigned char c;
+
+        pos = Wrap((s->windowHead + i), WINDOW_SIZE);
+        c = slidingWindow[pos];
+        ListNext[pos] = NULL_INDEX;
+
+        if (ListHeads[c] == NULL_INDEX)
+        {
+            ListHeads[c] = pos;
+        }
+        else
+        {
+            ListNext[tails[c]] = pos;
+        }
+
+        tails[c] = pos;
+    }
+}
+
+/****************************************************************************
+*   Function   : Replay
+*   Description: Times repeats calls of one implementation's FindMatch on
+*                every snapshot.  Restoring a snapshot is not timed.
+*   Parameters : impl - implementation to time
+*                snapshots - captured states
+*                count - number of states
+*                repeats - calls per state
+*                ns - receives the total time in nanoseconds
+*                cycles - receives the total time stamp counter cycles
+*   Effects    : Uses slidingWindow and uncodedLookahead
+*   Returned   : Number of states whose match length differs from the
+*                reference
+****************************************************************************/
+static size_t Replay(impl_t impl, const snapshot_t *snapshots, size_t count,
+    unsigned int repeats, double *ns, unsigned long long *cycles)
+{
+    static unsigned char window[WINDOW_SIZE];
+    static unsigned char lookahead[MAX_CODED];
+    size_t n, mismatches;
+    unsigned int r, length, offset;
+    double start;
+    unsigned long long startCycles;
+
+    *ns = 0;
+    *cycles = 0;
+    mismatches = 0;
+
+    for (n = 0; n < count; n++)
+    {
+        const snapshot_t *s = &snapshots[n];
+
+        switch (impl)
+        {
+            case FM_BRUTE:
+                memcpy(slidingWindow, s->window, WINDOW_SIZE);
+                memcpy(uncodedLookahead, s->lookahead, MAX_CODED);
+                break;
+
+            case FM_LIST:
+                RestoreList(s);
+                break;
+
+            default:
+                memcpy(window, s->window, WINDOW_SIZE);
+                memcpy(lookahead, s->lookahead, MAX_CODED);
+                break;
+        }
+
+        length = 0;
+        start = NowNs();
+        startCycles = ReadCycles();
+
+        for (r = 0; r < repeats; r++)
+        {
+            switch (impl)
+            {
+                case FM_BRUTE:
+                    length = BruteFindMatch(s->windowHead,
+                        s->uncodedHead).length;
+                    break;
+
+                case FM_LIST:
+                    length = ListFindMatch(s->windowHead,
+                        s->uncodedHead).length;
+                    break;
+
+                default:
+                    length = ClFindMatch(s->windowHead, s->uncodedHead,
+                        WINDOW_SIZE, window, lookahead, &offset);
+                    break;
+            }
+        }
+
+        *cycles += ReadCycles() - startCycles;
+        *ns += NowNs() - start;
+
+        if (length != s->length)
+        {
+            mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+/****************************************************************************
+*   Function   : main
+*   Description: This is the main function for this program, it validates
+*                the command line input, captures search states from the
+*                input file and reports the time of each FindMatch.
+*   Parameters : argc - number of parameters
+*                argv - parameter list
+*   Effects    : Prints a table of timings
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+int main(int argc, char *argv[])
+{
+    option_t *optList;
+    option_t *thisOpt;
+    FILE *fpIn;
+    unsigned char *data;
+    snapshot_t *snapshots;
+    size_t size, limit, count, interval, max, mismatches;
+    unsigned int repeats;
+    int i;
+
+    fpIn = NULL;
+    limit = 16UL << 20;
+    interval = 16;
+    max = 2000;
+    repeats = 16;
+
+    optList = GetOptList(argc, argv, "i:l:s:n:r:h?");
+    thisOpt = optList;
+
+    while (thisOpt != NULL)
+    {
+        switch(thisOpt->option)
+        {
+            case 'i':       /* input file name */
+                if (fpIn != NULL)
+                {
+                    fclose(fpIn);
+                }
+
+                fpIn = fopen(thisOpt->argument, "rb");
+                if (fpIn == NULL)
+                {
+                    perror("Opening input file");
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'l':       /* bytes of input to parse */
+                limit = strtoul(thisOpt->argument, NULL, 0);
+                break;
+
+            case 's':       /* capture interval */
+                interval = strtoul(thisOpt->argument, NULL, 0);
+                if (interval == 0)
+                {
+                    interval = 1;
+                }
+                break;
+
+            case 'n':       /* maximum number of snapshots */
+                max = strtoul(thisOpt->argument, NULL, 0);
+                break;
+
+            case 'r':       /* calls per snapshot */
+                repeats = (unsigned int)strtoul(thisOpt->argument, NULL, 0);
+                if (repeats == 0)
+                {
+                    repeats = 1;
+                }
+                break;
+
+            case 'h':
+            case '?':
+                printf("Usage: %s <options>\n\n", FindFileName(argv[0]));
+                printf("options:\n");
+                printf("  -i <filename> : Input file to capture states "
+                    "from.\n");
+                printf("  -l <bytes> : Bytes of input to parse "
+                    "(default 16M).\n");
+                printf("  -s <n> : Capture every n'th search (default 16).\n");
+                printf("  -n <n> : Maximum states to capture "
+                    "(default 2000).\n");
+                printf("  -r <n> : Calls per state (default 16).\n");
+                printf("  -h | ?  : Print out command line options.\n\n");
+
+                FreeOptList(optList);
+                if (fpIn != NULL)
+                {
+                    fclose(fpIn);
+                }
+                return 0;
+        }
+
+        optList = thisOpt->next;
+        free(thisOpt);
+        thisOpt = optList;
+    }
+
+    if (fpIn == NULL)
+    {
+        fprintf(stderr, "An input file is required (-i).\n");
+        return -1;
+    }
+
+    data = (unsigned char *)malloc(limit);
+    snapshots = (snapshot_t *)malloc(sizeof(snapshot_t) * max);
+    if (data == NULL || snapshots == NULL)
+    {
+        perror("Allocating buffers");
+        free(data);
+        free(snapshots);
+        fclose(fpIn);
+        return -1;
+    }
+
+    size = fread(data, 1, limit, fpIn);
+    fclose(fpIn);
+
+    count = CaptureSnapshots(data, size, interval, snapshots, max);
+    free(data);
+
+    if (count == 0)
+    {
+        fprintf(stderr, "Input file is empty.\n");
+        free(snapshots);
+        return -1;
+    }
+
+    printf("%lu states from %lu bytes, %u calls per state\n\n",
+        (unsigned long)count, (unsigned long)size, repeats);
+    printf("%-8s %12s %14s %14s %11s\n", "search", "ns/call",
+        "cycles/call", "cycles/byte", "mismatches");
+
+    for (i = 0; i < FM_NUM_IMPLS; i++)
+    {
+        double ns, calls;
+        unsigned long long cycles;
+
+        mismatches = Replay((impl_t)i, snapshots, count, repeats, &ns,
+            &cycles);
+        calls = (double)count * repeats;
+
+        if (cycles != 0)
+        {
+            printf("%-8s %12.1f %14.1f %14.3f %11lu\n", implNames[i],
+                ns / calls, cycles / calls, cycles / calls / WINDOW_SIZE,
+                (unsigned long)mismatches);
+        }
+        else
+        {
+            printf("%-8s %12.1f %14s %14s %11lu\n", implNames[i],
+                ns / calls, "n/a", "n/a", (unsigned long)mismatches);
+        }
+    }
+
+    printf("\ncycles are time stamp counter ticks, cycles/byte is per "
+        "sliding window byte\n");
+
+    free(snapshots);
+    return 0;
+}
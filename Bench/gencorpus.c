@@ -0,0 +1,796 @@
+/***************************************************************************
+*                  Deterministic Synthetic Benchmark Corpus
+*
+*   File    : gencorpus.c
+*   Purpose : Generate reproducible benchmark inputs of a chosen size and
+*             character so that Serial, OpenCL and Cuda timings can be
+*             compared on any machine without shipping real data.
+*
+****************************************************************************
+*
+* The output depends only on the command line (type, size, seed and the
+* tuning parameters).  All randomness comes from a private xorshift64*
+* generator and all multi-byte values are written byte by byte in little
+* endian order, so the same command produces the same bytes everywhere.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "optlist.h"
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+typedef enum
+{
+    CORPUS_RANDOM,      /* uniformly random, incompressible bytes */
+    CORPUS_ZEROS,       /* long zero runs with short random bursts */
+    CORPUS_TEXT,        /* English-like prose */
+    CORPUS_JSON,        /* repetitive JSON log lines */
+    CORPUS_TABLE,       /* binary records repeating at a fixed distance */
+    CORPUS_MIX,         /* segments of all of the above */
+    CORPUS_NUM_TYPES
+} corpus_type_t;
+
+typedef struct corpus_t
+{
+    uint64_t rng;               /* xorshift64* state */
+    unsigned long zeroRun;      /* mean length of a zero run */
+    unsigned long distance;     /* record size of the table corpus */
+    unsigned long segment;      /* segment size of the mix corpus */
+
+    /* pending output of line oriented generators */
+    char line[1024];
+    size_t lineLen;
+    size_t linePos;
+
+    /* per generator state that must survive buffer boundaries */
+    unsigned long zeroLeft;     /* bytes left in the current zero run */
+    unsigned long burstLeft;    /* bytes left in the current random burst */
+    unsigned long sentences;    /* sentences left in the paragraph */
+    unsigned long logCount;     /* JSON log lines emitted */
+    unsigned long recordCount;  /* table records emitted */
+    unsigned long recordPos;    /* position within the current record */
+    unsigned char *record;      /* current table record */
+    corpus_type_t mixType;      /* type of the current mix segment */
+    unsigned long mixLeft;      /* bytes left in the current mix segment */
+} corpus_t;
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define BUFFER_SIZE     65536
+#define DEFAULT_SEED    0x4C5A5353UL        /* "LZSS" */
+
+static const char *const typeNames[CORPUS_NUM_TYPES] =
+{
+    "random", "zeros", "text", "json", "table", "mix"
+};
+
+/* roughly ordered by frequency, so skewed picks favour the first words */
+static const char *const words[] =
+{
+    "the", "of", "and", "to", "a", "in", "is", "it", "that", "was",
+    "for", "on", "are", "as", "with", "his", "they", "at", "be", "this",
+    "from", "have", "or", "by", "one", "had", "not", "but", "what", "all",
+    "were", "when", "we", "there", "can", "an", "your", "which", "their",
+    "said", "if", "do", "will", "each", "about", "how", "up", "out", "them",
+    "then", "she", "many", "some", "so", "these", "would", "other", "into",
+    "has", "more", "her", "two", "like", "him", "see", "time", "could",
+    "no", "make", "than", "first", "been", "its", "who", "now", "people",
+    "my", "made", "over", "did", "down", "only", "way", "find", "use",
+    "may", "water", "long", "little", "very", "after", "words", "called",
+    "just", "where", "most", "know", "get", "through", "back", "much",
+    "before", "go", "good", "new", "write", "our", "used", "me", "man",
+    "too", "any", "day", "same", "right", "look", "think", "also",
+    "around", "another", "came", "come", "work", "three", "word", "must",
+    "because", "does", "part", "even", "place", "well", "such", "here",
+    "take", "why", "things", "help", "put", "years", "different", "away",
+    "again", "off", "went", "old", "number", "great", "tell", "men",
+    "say", "small", "every", "found", "still", "between", "name",
+    "should", "home", "big", "give", "air", "line", "set", "own", "under",
+    "read", "last", "never", "us", "left", "end", "along", "while",
+    "might", "next", "sound", "below", "saw", "something", "thought",
+    "both", "few", "those", "always", "show", "large", "often", "together",
+    "asked", "house", "world", "going", "want", "school", "important",
+    "until", "form", "food", "keep", "children", "feet", "land", "side",
+    "without", "boy", "once", "animals", "life", "enough", "took",
+    "sometimes", "four", "head", "above", "kind", "began", "almost",
+    "live", "page", "got", "earth", "need", "far", "hand", "high", "year",
+    "mother", "light", "parts", "country", "father", "let", "night",
+    "following", "picture", "being", "study", "second", "eyes", "soon",
+    "times", "story", "boys", "since", "white", "days", "paper", "hard",
+    "near", "sentence", "better", "best", "across", "during", "today",
+    "others", "however", "sure", "means", "knew", "try", "told", "young",
+    "miles", "sun", "ways", "thing", "whole", "hear", "example", "heard",
+    "several", "change", "answer", "room", "sea", "against", "top",
+    "turned", "learn", "point", "city", "play", "toward", "five", "using",
+    "himself", "usually"
+};
+
+#define NUM_WORDS   (sizeof(words) / sizeof(words[0]))
+
+static const char *const levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+static const char *const services[] =
+{
+    "auth", "billing", "catalog", "checkout", "gateway", "inventory",
+    "search", "shipping"
+};
+static const char *const methods[] = {"GET", "POST", "PUT", "DELETE"};
+static const char *const paths[] =
+{
+    "/api/v1/users", "/api/v1/orders", "/api/v1/items", "/api/v1/session",
+    "/api/v2/cart", "/api/v2/payments", "/healthz", "/metrics"
+};
+static const char *const messages[] =
+{
+    "request completed", "cache miss", "upstream timeout, retrying",
+    "token refreshed", "validation failed", "connection pool exhausted"
+};
+
+#define COUNT_OF(array) (sizeof(array) / sizeof(array[0]))
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+static size_t Generate(corpus_t *c, corpus_type_t type, unsigned char *buf,
+    size_t n);
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : NextRandom
+*   Description: xorshift64* pseudo-random number generator.  It is used
+*                instead of rand() so that output does not depend on the
+*                C library.
+*   Parameters : c - corpus state holding the generator
+*   Effects    : Advances the generator state
+*   Returned   : 64 pseudo-random bits
+****************************************************************************/
+static uint64_t NextRandom(corpus_t *c)
+{
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return c->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/****************************************************************************
+*   Function   : RandomBelow
+*   Description: Returns a pseudo-random number in the range [0, limit).
+*   Parameters : c - corpus state holding the generator
+*                limit - exclusive upper bound (must be non-zero)
+*   Effects    : Advances the generator state
+*   Returned   : Pseudo-random number less than limit
+****************************************************************************/
+static unsigned long RandomBelow(corpus_t *c, unsigned long limit)
+{
+    return (unsigned long)((NextRandom(c) >> 11) % limit);
+}
+
+/****************************************************************************
+*   Function   : SkewedWord
+*   Description: Picks a word index with a Zipf-like skew towards the start
+*                of the word list.
+*   Parameters : c - corpus state holding the generator
+*   Effects    : Advances the generator state
+*   Returned   : Index into words[]
+****************************************************************************/
+static unsigned long SkewedWord(corpus_t *c)
+{
+    double u;
+
+    u = (double)(NextRandom(c) >> 11) / (double)(1ULL << 53);
+    return (unsigned long)(u * u * u * NUM_WORDS);
+}
+
+/****************************************************************************
+*   Function   : DrainLine
+*   Description: Copies as much of the pending line as fits into buf.
+*   Parameters : c - corpus state holding the pending line
+*                buf - destination
+*                n - space left in buf
+*   Effects    : Advances the pending line position
+*   Returned   : Number of bytes copied
+****************************************************************************/
+static size_t DrainLine(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t count;
+
+    count = c->lineLen - c->linePos;
+    if (count > n)
+    {
+        count = n;
+    }
+
+    memcpy(buf, c->line + c->linePos, count);
+    c->linePos += count;
+    return count;
+}
+
+/****************************************************************************
+*   Function   : GenRandom
+*   Description: Fills buf with incompressible pseudo-random bytes.
+****************************************************************************/
+static size_t GenRandom(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+    uint64_t r;
+
+    r = 0;
+    for (i = 0; i < n; i++)
+    {
+        if ((i & 7) == 0)
+        {
+            r = NextRandom(c);
+        }
+
+        buf[i] = (unsigned char)r;
+        r >>= 8;
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : GenZeros
+*   Description: Fills buf with long runs of zeros separated by short bursts
+*                of random bytes, similar to sparse records or zero padded
+*                pages.  Run lengths vary uniformly around c->zeroRun.
+****************************************************************************/
+static size_t GenZeros(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        if (c->zeroLeft == 0 && c->burstLeft == 0)
+        {
+            c->zeroLeft = c->zeroRun / 2 + RandomBelow(c, c->zeroRun + 1);
+            c->burstLeft = 1 + RandomBelow(c, 64);
+        }
+
+        if (c->zeroLeft > 0)
+        {
+            size_t count = c->zeroLeft;
+
+            if (count > n - i)
+            {
+                count = n - i;
+            }
+
+            memset(buf + i, 0, count);
+            c->zeroLeft -= count;
+            i += count;
+        }
+        else
+        {
+            buf[i++] = (unsigned char)NextRandom(c);
+            c->burstLeft--;
+        }
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : GenText
+*   Description: Fills buf with English-like sentences built from a skewed
+*                pick of common words, grouped into paragraphs.
+****************************************************************************/
+static size_t GenText(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        if (c->linePos == c->lineLen)
+        {
+            unsigned long count, w;
+            size_t len;
+
+            /* build the next sentence */
+            count = 4 + RandomBelow(c, 16);
+            len = 0;
+
+            for (w = 0; w < count; w++)
+            {
+                const char *word = words[SkewedWord(c)];
+                size_t wordLen = strlen(word);
+
+                memcpy(c->line + len, word, wordLen);
+                if (w == 0)
+                {
+                    c->line[len] -= 'a' - 'A';
+                }
+
+                len += wordLen;
+
+                if (w + 1 < count)
+                {
+                    if (RandomBelow(c, 10) == 0)
+                    {
+                        c->line[len++] = ',';
+                    }
+
+                    c->line[len++] = ' ';
+                }
+            }
+
+            c->line[len++] = (RandomBelow(c, 12) == 0) ? '?' : '.';
+
+            if (c->sentences == 0)
+            {
+                c->sentences = 3 + RandomBelow(c, 5);
+            }
+
+            c->sentences--;
+            if (c->sentences == 0)
+            {
+                c->line[len++] = '\n';
+                c->line[len++] = '\n';
+            }
+            else
+            {
+                c->line[len++] = ' ';
+            }
+
+            c->lineLen = len;
+            c->linePos = 0;
+        }
+
+        i += DrainLine(c, buf + i, n - i);
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : GenJson
+*   Description: Fills buf with one-object-per-line JSON log records.  The
+*                timestamps advance steadily and most fields come from small
+*                vocabularies, as in typical service logs.
+****************************************************************************/
+static size_t GenJson(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        if (c->linePos == c->lineLen)
+        {
+            unsigned long ms, secs, level, status;
+            int len;
+
+            /* about 25 log lines per second */
+            ms = c->logCount * 40 + RandomBelow(c, 40);
+            secs = ms / 1000;
+
+            level = RandomBelow(c, 20);
+            level = (level < 14) ? 0 : (level < 17) ? 1 : (level < 19) ? 2 : 3;
+            status = (level == 3) ? 500 : (level == 2) ? 429 : 200;
+
+            len = sprintf(c->line,
+                "{\"ts\":\"2024-01-%02luT%02lu:%02lu:%02lu.%03luZ\","
+                "\"level\":\"%s\",\"service\":\"%s\",\"method\":\"%s\","
+                "\"path\":\"%s\",\"status\":%lu,\"latency_ms\":%lu,"
+                "\"request_id\":\"%08lx\",\"msg\":\"%s\"}\n",
+                1 + (secs / 86400) % 28, (secs / 3600) % 24,
+                (secs / 60) % 60, secs % 60, ms % 1000,
+                levels[level], services[RandomBelow(c, COUNT_OF(services))],
+                methods[RandomBelow(c, COUNT_OF(methods))],
+                paths[RandomBelow(c, COUNT_OF(paths))], status,
+                1 + RandomBelow(c, 250),
+                (unsigned long)(NextRandom(c) & 0xFFFFFFFFUL),
+                messages[(level == 0) ? 0 :
+                    RandomBelow(c, COUNT_OF(messages))]);
+
+            c->lineLen = (size_t)len;
+            c->linePos = 0;
+            c->logCount++;
+        }
+
+        i += DrainLine(c, buf + i, n - i);
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : MakeRecord
+*   Description: Builds the next table record.  Each record is
+*                c->distance bytes: a little endian id and timestamp, a
+*                sensor number, a status word, a noisy reading and constant
+*                padding.  Consecutive records differ in only a few bytes,
+*                so the data repeats at a distance of c->distance.
+****************************************************************************/
+static void MakeRecord(corpus_t *c)
+{
+    unsigned long id, ts, value, pos;
+    unsigned char *r;
+
+    r = c->record;
+    id = c->recordCount;
+    ts = 1700000000UL + id * 60;
+    value = 2000 + RandomBelow(c, 64);
+
+    r[0] = (unsigned char)id;
+    r[1] = (unsigned char)(id >> 8);
+    r[2] = (unsigned char)(id >> 16);
+    r[3] = (unsigned char)(id >> 24);
+    r[4] = (unsigned char)ts;
+    r[5] = (unsigned char)(ts >> 8);
+    r[6] = (unsigned char)(ts >> 16);
+    r[7] = (unsigned char)(ts >> 24);
+    r[8] = (unsigned char)(id % 8);
+    r[9] = 0;
+    r[10] = (RandomBelow(c, 50) == 0) ? 1 : 0;
+    r[11] = 0;
+    r[12] = (unsigned char)value;
+    r[13] = (unsigned char)(value >> 8);
+    r[14] = 0;
+    r[15] = 0;
+
+    for (pos = 16; pos < c->distance; pos++)
+    {
+        r[pos] = (unsigned char)(0xA0 + (pos & 0x0F));
+    }
+
+    c->recordCount++;
+}
+
+/****************************************************************************
+*   Function   : GenTable
+*   Description: Fills buf with fixed-size binary records.
+****************************************************************************/
+static size_t GenTable(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        size_t count;
+
+        if (c->recordPos == 0)
+        {
+            MakeRecord(c);
+        }
+
+        count = c->distance - c->recordPos;
+        if (count > n - i)
+        {
+            count = n - i;
+        }
+
+        memcpy(buf + i, c->record + c->recordPos, count);
+        c->recordPos = (c->recordPos + count) % c->distance;
+        i += count;
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : GenMix
+*   Description: Fills buf with segments of c->segment bytes, each taken
+*                from a randomly chosen base generator.  Every base
+*                generator keeps its own state between segments.
+****************************************************************************/
+static size_t GenMix(corpus_t *c, unsigned char *buf, size_t n)
+{
+    size_t i;
+
+    i = 0;
+    while (i < n)
+    {
+        size_t count;
+
+        if (c->mixLeft == 0)
+        {
+            c->mixType = (corpus_type_t)RandomBelow(c, CORPUS_MIX);
+            c->mixLeft = c->segment;
+
+            /* text and JSON share the pending line, start afresh */
+            c->linePos = c->lineLen;
+        }
+
+        count = c->mixLeft;
+        if (count > n - i)
+        {
+            count = n - i;
+        }
+
+        Generate(c, c->mixType, buf + i, count);
+        c->mixLeft -= count;
+        i += count;
+    }
+
+    return n;
+}
+
+/****************************************************************************
+*   Function   : Generate
+*   Description: Dispatches to the generator for the requested type.
+*   Parameters : c - corpus state
+*                type - type of data to produce
+*                buf - destination
+*                n - number of bytes to produce
+*   Effects    : Fills buf and advances generator state
+*   Returned   : Number of bytes written to buf
+****************************************************************************/
+static size_t Generate(corpus_t *c, corpus_type_t type, unsigned char *buf,
+    size_t n)
+{
+    switch (type)
+    {
+        case CORPUS_RANDOM:
+            return GenRandom(c, buf, n);
+
+        case CORPUS_ZEROS:
+            return GenZeros(c, buf, n);
+
+        case CORPUS_TEXT:
+            return GenText(c, buf, n);
+
+        case CORPUS_JSON:
+            return GenJson(c, buf, n);
+
+        case CORPUS_TABLE:
+            return GenTable(c, buf, n);
+
+        default:
+            return GenMix(c, buf, n);
+    }
+}
+
+/****************************************************************************
+*   Function   : ParseSize
+*   Description: Converts a size argument with an optional K, M or G
+*                (binary) suffix into a byte count.
+*   Parameters : arg - size string
+*                size - receives the byte count
+*   Effects    : None
+*   Returned   : 0 for success, -1 for a malformed size.
+****************************************************************************/
+static int ParseSize(const char *arg, unsigned long long *size)
+{
+    char *end;
+    unsigned long long value;
+
+    value = strtoull(arg, &end, 10);
+    if (end == arg)
+    {
+        return -1;
+    }
+
+    switch (*end)
+    {
+        case 'g': case 'G':
+            value <<= 10;
+            /* fall through */
+        case 'm': case 'M':
+            value <<= 10;
+            /* fall through */
+        case 'k': case 'K':
+            value <<= 10;
+            end++;
+            break;
+
+        default:
+            break;
+    }
+
+    if (*end != '\0')
+    {
+        return -1;
+    }
+
+    *size = value;
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : main
+*   Description: This is the main function for this program, it validates
+*                the command line input and, if valid, writes the requested
+*                amount of synthetic data to the output file.
+*   Parameters : argc - number of parameters
+*                argv - parameter list
+*   Effects    : Writes the corpus to the output file
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+int main(int argc, char *argv[])
+{
+    option_t *optList;
+    option_t *thisOpt;
+    FILE *fpOut;
+    corpus_t corpus;
+    corpus_type_t type;
+    unsigned long long size, done;
+    unsigned char *buffer;
+    unsigned long seed;
+    int i, status;
+
+    fpOut = NULL;
+    type = CORPUS_MIX;
+    size = 1UL << 20;
+    seed = DEFAULT_SEED;
+    memset(&corpus, 0, sizeof(corpus));
+    corpus.zeroRun = 4096;
+    corpus.distance = 64;
+    corpus.segment = 65536;
+    status = 0;
+
+    optList = GetOptList(argc, argv, "t:s:r:z:d:m:o:h?");
+    thisOpt = optList;
+
+    while (thisOpt != NULL)
+    {
+        switch(thisOpt->option)
+        {
+            case 't':       /* corpus type */
+                for (i = 0; i < CORPUS_NUM_TYPES; i++)
+                {
+                    if (0 == strcmp(thisOpt->argument, typeNames[i]))
+                    {
+                        break;
+                    }
+                }
+
+                if (i == CORPUS_NUM_TYPES)
+                {
+                    fprintf(stderr, "Unknown corpus type %s.\n",
+                        thisOpt->argument);
+                    status = -1;
+                }
+
+                type = (corpus_type_t)i;
+                break;
+
+            case 's':       /* output size */
+                if (ParseSize(thisOpt->argument, &size) != 0)
+                {
+                    fprintf(stderr, "Invalid size %s.\n", thisOpt->argument);
+                    status = -1;
+                }
+                break;
+
+            case 'r':       /* random seed */
+                seed = strtoul(thisOpt->argument, NULL, 0);
+                break;
+
+            case 'z':       /* mean zero run length */
+                corpus.zeroRun = strtoul(thisOpt->argument, NULL, 0);
+                break;
+
+            case 'd':       /* table record size / repeat distance */
+                corpus.distance = strtoul(thisOpt->argument, NULL, 0);
+                if (corpus.distance < 16)
+                {
+                    fprintf(stderr, "Repeat distance must be at least 16.\n");
+                    status = -1;
+                }
+                break;
+
+            case 'm':       /* mix segment size */
+                corpus.segment = strtoul(thisOpt->argument, NULL, 0);
+                if (corpus.segment == 0)
+                {
+                    fprintf(stderr, "Segment size must not be zero.\n");
+                    status = -1;
+                }
+                break;
+
+            case 'o':       /* output file name */
+                if (fpOut != NULL)
+                {
+                    fprintf(stderr, "Multiple output files not allowed.\n");
+                    status = -1;
+                    break;
+                }
+
+                fpOut = fopen(thisOpt->argument, "wb");
+                if (fpOut == NULL)
+                {
+                    perror("Opening output file");
+                    status = -1;
+                }
+                break;
+
+            case 'h':
+            case '?':
+                printf("Usage: %s <options>\n\n", FindFileName(argv[0]));
+                printf("options:\n");
+                printf("  -t <type> : random, zeros, text, json, table or "
+                    "mix (default mix).\n");
+                printf("  -s <size> : Bytes to write, K/M/G suffixes "
+                    "allowed (default 1M).\n");
+                printf("  -r <seed> : Random seed (default 0x%lX).\n",
+                    (unsigned long)DEFAULT_SEED);
+                printf("  -z <len> : Mean zero run length (default 4096).\n");
+                printf("  -d <len> : Table record size, the repeat "
+                    "distance (default 64).\n");
+                printf("  -m <len> : Mix segment size (default 65536).\n");
+                printf("  -o <filename> : Name of output file.\n");
+                printf("  -h | ?  : Print out command line options.\n\n");
+                printf("Default: %s -t mix -s 1M -o stdout\n",
+                    FindFileName(argv[0]));
+
+                FreeOptList(optList);
+                if (fpOut != NULL)
+                {
+                    fclose(fpOut);
+                }
+                return 0;
+        }
+
+        optList = thisOpt->next;
+        free(thisOpt);
+        thisOpt = optList;
+    }
+
+    if (status != 0)
+    {
+        if (fpOut != NULL)
+        {
+            fclose(fpOut);
+        }
+        return -1;
+    }
+
+    if (fpOut == NULL)
+    {
+        fpOut = stdout;
+    }
+
+    /* a zero seed would leave xorshift stuck at zero */
+    corpus.rng = ((uint64_t)seed << 1) | 1;
+    corpus.record = (unsigned char *)malloc(corpus.distance);
+    buffer = (unsigned char *)malloc(BUFFER_SIZE);
+
+    if (corpus.record == NULL || buffer == NULL)
+    {
+        perror("Allocating buffers");
+        free(corpus.record);
+        free(buffer);
+        fclose(fpOut);
+        return -1;
+    }
+
+    for (done = 0; done < size; )
+    {
+        size_t count = BUFFER_SIZE;
+
+        if (count > size - done)
+        {
+            count = (size_t)(size - done);
+        }
+
+        Generate(&corpus, type, buffer, count);
+        if (fwrite(buffer, 1, count, fpOut) != count)
+        {
+            perror("Writing output file");
+            status = -1;
+            break;
+        }
+
+        done += count;
+    }
+
+    free(corpus.record);
+    free(buffer);
+    fclose(fpOut);
+    return status;
+}
@@ -0,0 +1,1647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "clengine.h"
+
+// kernel sources, turned into arrays by xxd -i at build time
+#include "encode_cl.h"
+#include "decode_cl.h"
+
+// SPIR-V compiled from the same sources by make SPIRV=1
+#ifdef LZSS_SPIRV
+#include "encode_spv.h"
+#include "decode_spv.h"
+#endif
+
+#define MAX_PATH_SIZE 1024
+#define MAX_PLATFORMS 16
+#define MAX_DEVICES 64
+
+static const struct
+{
+    const char *name;
+    cl_device_type type;
+} deviceTypes[] = {
+    {"gpu", CL_DEVICE_TYPE_GPU},
+    {"cpu", CL_DEVICE_TYPE_CPU},
+    {"accelerator", CL_DEVICE_TYPE_ACCELERATOR},
+    {"all", CL_DEVICE_TYPE_ALL}
+};
+
+#define NUM_DEVICE_TYPES (sizeof(deviceTypes) / sizeof(deviceTypes[0]))
+
+static const char *kernelFiles[NUM_KERNELS] = {"encode.cl", "decode.cl", "encode.cl", "encode.cl", "encode.cl", "decode.cl"};
+static const char *kernelNames[NUM_KERNELS] = {"EncodeLZSS", "DecodeLZSS", "EncodeLZSSGroup", "EncodeLZSSHash", "EncodeLZSSVector", "DecodeLZSSGroup"};
+static const unsigned char *kernelSources[NUM_KERNELS] = {encode_cl, decode_cl, encode_cl, encode_cl, encode_cl, decode_cl};
+static const unsigned int *kernelSourceSizes[NUM_KERNELS] = {&encode_cl_len, &decode_cl_len, &encode_cl_len, &encode_cl_len, &encode_cl_len, &decode_cl_len};
+#ifdef LZSS_SPIRV
+static const unsigned char *kernelIL[NUM_KERNELS] = {encode_spv, decode_spv, encode_spv, encode_spv, encode_spv, decode_spv};
+static const unsigned int *kernelILSizes[NUM_KERNELS] = {&encode_spv_len, &decode_spv_len, &encode_spv_len, &encode_spv_len, &encode_spv_len, &decode_spv_len};
+#endif
+
+// group kernels run a work-group per block instead of a work-item
+static const int kernelPerGroup[NUM_KERNELS] = {0, 0, 1, 0, 0, 1};
+
+// names for ParseEncoder, by kernel
+static const struct
+{
+    const char *name;
+    kernel_id_t kernel;
+} encoders[] = {
+    {"serial", KERNEL_ENCODE},
+    {"group", KERNEL_ENCODE_GROUP},
+    {"hash", KERNEL_ENCODE_HASH},
+    {"vector", KERNEL_ENCODE_VECTOR}
+};
+
+#define NUM_ENCODERS (sizeof(encoders) / sizeof(encoders[0]))
+
+// and for ParseDecoder
+static const struct
+{
+    const char *name;
+    kernel_id_t kernel;
+} decoders[] = {
+    {"serial", KERNEL_DECODE},
+    {"group", KERNEL_DECODE_GROUP}
+};
+
+#define NUM_DECODERS (sizeof(decoders) / sizeof(decoders[0]))
+
+// events of a run, kept to wait on and to profile
+typedef struct event_list_t
+{
+    cl_event *event;
+    int *phase;             // phase_id_t of each
+    size_t *bytes;          // copied, or taken in by a kernel
+    int count;
+} event_list_t;
+
+static int FindDevice(const cl_device_select_t *select,
+    cl_platform_id *platform, cl_device_id *device);
+static const char *DeviceTypeName(cl_device_type type);
+static void WorkSize(cl_engine_t *engine, kernel_id_t which, unsigned int n,
+    size_t *globalSize, size_t *localSize);
+static int BuildKernel(cl_engine_t *engine, kernel_id_t which);
+static void BuildOptions(const kernel_params_t *params, kernel_id_t which,
+    char *options, size_t size);
+static void FreeVariant(cl_variant_t *variant);
+static void ProfileEvents(cl_engine_t *engine, const event_list_t *events);
+static char *LoadSource(kernel_id_t which, size_t *size, int *fromFile);
+#ifdef LZSS_SPIRV
+static cl_program BuildIL(cl_engine_t *engine, kernel_id_t which,
+    const char *options);
+#endif
+static cl_program BuildSource(cl_engine_t *engine, const char *source_str,
+    size_t source_size, const char *options);
+static int CachePath(cl_engine_t *engine, const char *source,
+    size_t source_size, const char *options, char *path, size_t size);
+static cl_program LoadCachedProgram(cl_engine_t *engine, const char *path,
+    const char *options);
+static void StoreProgramBinary(cl_engine_t *engine, cl_program program,
+    const char *path);
+static int ReserveBuffer(cl_engine_t *engine, cl_mem *buffer, size_t *size,
+    size_t bytes, cl_mem_flags flags);
+
+int ParseDeviceSelect(const char *spec, cl_device_select_t *select)
+{
+    const char *p = spec;
+    char *end;
+
+    select->type = 0;
+    select->platform = -1;
+    select->device = -1;
+
+    if (spec == NULL || *spec == '\0') {
+        return 0;
+    }
+
+    for (size_t i = 0; i < NUM_DEVICE_TYPES; i++) {
+        size_t len = strlen(deviceTypes[i].name);
+
+        if (strncasecmp(p, deviceTypes[i].name, len) == 0 &&
+            (p[len] == '\0' || p[len] == ':')) {
+            select->type = deviceTypes[i].type;
+            p += len;
+            if (*p == '\0') {
+                return 0;
+            }
+            p++;
+            break;
+        }
+    }
+
+    select->platform = (int)strtol(p, &end, 10);
+    if (end == p || select->platform < 0) {
+        fprintf(stderr, "Bad device selection: %s\n", spec);
+        return -1;
+    }
+
+    if (*end == ':') {
+        p = end + 1;
+        select->device = (int)strtol(p, &end, 10);
+        if (end == p || select->device < 0) {
+            fprintf(stderr, "Bad device selection: %s\n", spec);
+            return -1;
+        }
+    }
+
+    if (*end != '\0') {
+        fprintf(stderr, "Bad device selection: %s\n", spec);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ListDevices(FILE *fp)
+{
+    cl_platform_id platforms[MAX_PLATFORMS];
+    cl_device_id devices[MAX_DEVICES];
+    cl_uint numPlatforms, numDevices;
+    cl_engine_t probe;
+    cl_int err;
+
+    err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &numPlatforms);
+    if (err != CL_SUCCESS) {
+        perror("Couldn't get platforms\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    if (numPlatforms > MAX_PLATFORMS) {
+        numPlatforms = MAX_PLATFORMS;
+    }
+
+    memset(&probe, 0, sizeof(probe));
+    for (cl_uint p = 0; p < numPlatforms; p++) {
+        char *name, *version;
+
+        probe.platform = platforms[p];
+        name = GetInfoString(&probe, CL_PLATFORM_NAME, 1);
+        version = GetInfoString(&probe, CL_PLATFORM_VERSION, 1);
+        fprintf(fp, "Platform %u: %s (%s)\n", p, name, version);
+        free(name);
+        free(version);
+
+        err = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, MAX_DEVICES, devices, &numDevices);
+        if (err != CL_SUCCESS) {
+            continue;
+        }
+        if (numDevices > MAX_DEVICES) {
+            numDevices = MAX_DEVICES;
+        }
+
+        for (cl_uint d = 0; d < numDevices; d++) {
+            cl_device_type type = 0;
+            cl_uint units = 0;
+            cl_ulong memory = 0;
+
+            probe.device = devices[d];
+            clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+            clGetDeviceInfo(devices[d], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(memory), &memory, NULL);
+            name = GetInfoString(&probe, CL_DEVICE_NAME, 0);
+            version = GetInfoString(&probe, CL_DEVICE_VERSION, 0);
+            fprintf(fp, "  %u:%u  %-11s %s, %s, %u compute units, %llu MB\n",
+                p, d, DeviceTypeName(type), name, version, units,
+                (unsigned long long)(memory >> 20));
+            free(name);
+            free(version);
+        }
+    }
+
+    return 0;
+}
+
+// name of the first type in deviceTypes that type has
+static const char *DeviceTypeName(cl_device_type type)
+{
+    for (size_t i = 0; i < NUM_DEVICE_TYPES; i++) {
+        if (type & deviceTypes[i].type) {
+            return deviceTypes[i].name;
+        }
+    }
+    return "other";
+}
+
+/*
+ * Finds the device select asks for.  Device indices count the devices of
+ * the selected type on the platform, as listed by clGetDeviceIDs.
+ */
+static int FindDevice(const cl_device_select_t *select,
+    cl_platform_id *platform, cl_device_id *device)
+{
+    cl_platform_id platforms[MAX_PLATFORMS];
+    cl_device_id devices[MAX_DEVICES];
+    cl_uint numPlatforms, numDevices;
+    cl_device_type types[2];
+    int numTypes;
+    cl_int err;
+
+    err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &numPlatforms);
+    if (err != CL_SUCCESS) {
+        perror("Couldn't get platforms\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    if (numPlatforms > MAX_PLATFORMS) {
+        numPlatforms = MAX_PLATFORMS;
+    }
+
+    // an index without a type counts all devices, as ListDevices does
+    if (select->type == 0 && select->device < 0) {
+        types[0] = CL_DEVICE_TYPE_GPU;
+        types[1] = CL_DEVICE_TYPE_ALL;
+        numTypes = 2;
+    } else {
+        types[0] = (select->type == 0) ? CL_DEVICE_TYPE_ALL : select->type;
+        numTypes = 1;
+    }
+
+    for (int t = 0; t < numTypes; t++) {
+        for (cl_uint p = 0; p < numPlatforms; p++) {
+            if (select->platform >= 0 && (cl_uint)select->platform != p) {
+                continue;
+            }
+
+            err = clGetDeviceIDs(platforms[p], types[t], MAX_DEVICES, devices, &numDevices);
+            if (err != CL_SUCCESS || numDevices == 0) {
+                continue;
+            }
+            if (numDevices > MAX_DEVICES) {
+                numDevices = MAX_DEVICES;
+            }
+
+            if (select->device < 0) {
+                *platform = platforms[p];
+                *device = devices[0];
+                return 0;
+            }
+            if ((cl_uint)select->device < numDevices) {
+                *platform = platforms[p];
+                *device = devices[select->device];
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// ns on the host's monotonic clock, for the setup the queues can't time
+static cl_ulong HostTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (cl_ulong)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Picks the device select asks for and sets up a context and command
+ * queues on it.  Programs and buffers are created when first needed.
+ */
+cl_engine_t *CreateEngine(const cl_device_select_t *select, int queues,
+    int profile)
+{
+    // profiling tells how far the queues overlapped, and what each phase took
+    cl_queue_properties profiling[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    cl_device_select_t defaultSelect = {0, -1, -1};
+    cl_engine_t *engine;
+    cl_ulong started;
+    char *name;
+    cl_int err;
+
+    if (select == NULL) {
+        select = &defaultSelect;
+    }
+
+    engine = (cl_engine_t *)calloc(1, sizeof(cl_engine_t));
+    if (engine == NULL) {
+        perror("Allocating engine\n");
+        return NULL;
+    }
+    engine->variant[0].params.windowSize = WINDOWSIZE;
+    engine->variant[0].params.maxCoded = MAX_CODED;
+    engine->variants = 1;
+    engine->active = &engine->variant[0];
+
+    if (FindDevice(select, &engine->platform, &engine->device) != 0) {
+        fprintf(stderr, "No matching OpenCL device, see the device list.\n");
+        free(engine);
+        return NULL;
+    }
+
+    clGetDeviceInfo(engine->device, CL_DEVICE_TYPE, sizeof(engine->type), &engine->type, NULL);
+    clGetDeviceInfo(engine->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(engine->units), &engine->units, NULL);
+    if (engine->units == 0) {
+        engine->units = 1;
+    }
+    if (clGetDeviceInfo(engine->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(engine->unified), &engine->unified, NULL) != CL_SUCCESS) {
+        engine->unified = CL_FALSE;
+    }
+
+    /* Platform Info Start */
+    cl_platform_info param_name[5] = {CL_PLATFORM_PROFILE,
+                                      CL_PLATFORM_VERSION,
+                                      CL_PLATFORM_NAME,
+                                      CL_PLATFORM_VENDOR,
+                                      CL_PLATFORM_EXTENSIONS};
+
+    printf("\nPlatform:\n");
+    for(int j = 0; j < 5; ++j) {
+        char *param_value = GetInfoString(engine, param_name[j], 1);
+        printf("%s\n", param_value);
+        free(param_value);
+    }
+    name = GetInfoString(engine, CL_DEVICE_NAME, 0);
+    printf("Device: %s\n", name);
+    free(name);
+    printf("\n\n");
+
+    started = HostTime();
+    engine->context = clCreateContext(0, 1, &engine->device, NULL, NULL, &err);
+
+    if(err != CL_SUCCESS) {
+        perror("Problem creating context\n");
+        printf("Error Code: %d\n", err);
+        free(engine);
+        return NULL;
+    }
+
+    if (queues <= 0) {
+        queues = (engine->type & CL_DEVICE_TYPE_CPU) ? 1 : NUM_QUEUES;
+    }
+    engine->queues = (queues == 1) ? 1 : NUM_QUEUES;
+    engine->pieces = (queues == 1) ? 1 : OVERLAP_PIECES;
+    engine->profiling = (engine->queues > 1 || profile);
+
+    for (int i = 0; i < engine->queues; i++) {
+        engine->queue[i] = clCreateCommandQueueWithProperties(engine->context, engine->device,
+            engine->profiling ? profiling : NULL, &err);
+        if(err != CL_SUCCESS) {
+            perror("Problem creating command queue\n");
+            printf("Error Code: %d\n", err);
+            engine->queue[i] = NULL;
+            FreeEngine(engine);
+            return NULL;
+        }
+    }
+    for (int i = engine->queues; i < NUM_QUEUES; i++) {
+        engine->queue[i] = engine->queue[0];
+    }
+    engine->contextTime = HostTime() - started;
+
+    return engine;
+}
+
+void FreeEngine(cl_engine_t *engine)
+{
+    if (engine == NULL) {
+        return;
+    }
+
+    for (int p = 0; p < OVERLAP_PIECES; p++) {
+        for (int i = 0; i < NUM_BUFFERS; i++) {
+            if (engine->buffer[p][i] != NULL) {
+                clReleaseMemObject(engine->buffer[p][i]);
+            }
+        }
+    }
+
+    for (int v = 0; v < engine->variants; v++) {
+        FreeVariant(&engine->variant[v]);
+    }
+
+    if (engine->counters != NULL) {
+        clReleaseMemObject(engine->counters);
+    }
+
+    for (int i = 0; i < engine->queues; i++) {
+        if (engine->queue[i] != NULL) {
+            clReleaseCommandQueue(engine->queue[i]);
+        }
+    }
+    if (engine->context != NULL) {
+        clReleaseContext(engine->context);
+    }
+
+    free(engine);
+}
+
+static int CreateKernel(cl_variant_t *variant, kernel_id_t which)
+{
+    cl_int err;
+
+    variant->kernel[which] = clCreateKernel(variant->program[which], kernelNames[which], &err);
+    if(err != CL_SUCCESS) {
+        perror("Problem creating kernel.\n");
+        printf("Error Code: %d\n", err);
+        variant->kernel[which] = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int CheckKernelParams(const kernel_params_t *params)
+{
+    cl_uint w = params->windowSize;
+
+    if (w < MIN_WINDOWSIZE || w > WINDOWSIZE || (w & (w - 1)) != 0) {
+        fprintf(stderr, "Window must be a power of 2 from %d to %d.\n", MIN_WINDOWSIZE, WINDOWSIZE);
+        return -1;
+    }
+    if (params->maxCoded <= MAX_UNCODED || params->maxCoded > MAX_CODED) {
+        fprintf(stderr, "Longest match must be from %d to %d.\n", MAX_UNCODED + 1, MAX_CODED);
+        return -1;
+    }
+    return 0;
+}
+
+// releases the kernels and programs of a variant that are built
+static void FreeVariant(cl_variant_t *variant)
+{
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        if (variant->kernel[i] != NULL) {
+            clReleaseKernel(variant->kernel[i]);
+        }
+        if (variant->program[i] != NULL) {
+            clReleaseProgram(variant->program[i]);
+        }
+    }
+    memset(variant, 0, sizeof(*variant));
+}
+
+int UseKernelParams(cl_engine_t *engine, const kernel_params_t *params)
+{
+    kernel_params_t defaults = {WINDOWSIZE, MAX_CODED};
+    cl_variant_t *variant;
+    int v;
+
+    if (params == NULL) {
+        params = &defaults;
+    }
+    if (CheckKernelParams(params) != 0) {
+        return -1;
+    }
+
+    for (v = 0; v < engine->variants; v++) {
+        if (memcmp(&engine->variant[v].params, params, sizeof(*params)) == 0) {
+            engine->active = &engine->variant[v];
+            return 0;
+        }
+    }
+
+    if (engine->variants < MAX_VARIANTS) {
+        variant = &engine->variant[engine->variants++];
+    } else {
+        // all in use, the oldest after the defaults makes room
+        FreeVariant(&engine->variant[1]);
+        memmove(&engine->variant[1], &engine->variant[2], sizeof(cl_variant_t) * (MAX_VARIANTS - 2));
+        variant = &engine->variant[MAX_VARIANTS - 1];
+        memset(variant, 0, sizeof(*variant));
+    }
+    variant->params = *params;
+    engine->active = variant;
+    return 0;
+}
+
+/*
+ * -D options for the sizes that aren't the kernels' defaults.  The
+ * defaults get none, so the embedded SPIR-V, which can't take options,
+ * is used for them.  Only the encode kernels have a longest match.
+ */
+static void BuildOptions(const kernel_params_t *params, kernel_id_t which,
+    char *options, size_t size)
+{
+    int used = 0;
+
+    options[0] = '\0';
+    if (params->windowSize != WINDOWSIZE) {
+        used += snprintf(options + used, size - used, "-D WINDOW_SIZE=%u ", params->windowSize);
+    }
+    if (kernelSources[which] != decode_cl && params->maxCoded != MAX_CODED) {
+        snprintf(options + used, size - used, "-D MAX_CODED=%u ", params->maxCoded);
+    }
+}
+
+/*
+ * Builds a kernel of the active variant for the engine's device and
+ * creates the kernel object.  Only done the first time the kernel is run
+ * for the variant.  A binary built by an earlier
+ * run is used when the cache has one for the same source, options, device
+ * and driver.  Otherwise the embedded SPIR-V is used if there is one and
+ * the device takes it, and the embedded source is compiled if not.
+ */
+static int BuildKernel(cl_engine_t *engine, kernel_id_t which)
+{
+    char *source_str;
+    size_t source_size;
+    char path[MAX_PATH_SIZE];
+    char options[64];
+    int cached, fromFile;
+    cl_variant_t *variant = engine->active;
+    cl_program program = NULL;
+
+    // kernels from the same file share its program
+    for (int i = 0; i < NUM_KERNELS; i++) {
+        if (variant->program[i] != NULL && kernelSources[i] == kernelSources[which]) {
+            clRetainProgram(variant->program[i]);
+            program = variant->program[i];
+            break;
+        }
+    }
+    if (program != NULL) {
+        variant->program[which] = program;
+        return CreateKernel(variant, which);
+    }
+
+    BuildOptions(&variant->params, which, options, sizeof(options));
+
+    source_str = LoadSource(which, &source_size, &fromFile);
+    if (source_str == NULL) {
+        fprintf(stderr, "Failed to load kernel.\n");
+        return -1;
+    }
+
+    cached = (CachePath(engine, source_str, source_size, options, path, sizeof(path)) == 0);
+    if (cached) {
+        program = LoadCachedProgram(engine, path, options);
+    }
+
+    if (program != NULL) {
+        printf("Loaded cached program %s\n", path);
+    } else {
+#ifdef LZSS_SPIRV
+        // the SPIR-V was compiled from the embedded source with the defaults
+        if (!fromFile && options[0] == '\0') {
+            program = BuildIL(engine, which, options);
+        }
+        if (program == NULL)
+#endif
+        program = BuildSource(engine, source_str, source_size, options);
+        if (program != NULL && cached) {
+            StoreProgramBinary(engine, program, path);
+        }
+    }
+    free(source_str);
+
+    if (program == NULL) {
+        return -1;
+    }
+    variant->program[which] = program;
+
+    return CreateKernel(variant, which);
+}
+
+/*
+ * Returns a malloc'ed copy of a kernel's source.  It is built into the
+ * executable, but if $LZSS_CL_KERNELS names a directory the .cl file is
+ * read from there instead, for trying kernel changes without a rebuild.
+ */
+static char *LoadSource(kernel_id_t which, size_t *size, int *fromFile)
+{
+    const char *dir = getenv("LZSS_CL_KERNELS");
+    char path[MAX_PATH_SIZE];
+    char *source_str;
+    long length;
+    FILE *fp;
+
+    *fromFile = (dir != NULL && dir[0] != '\0');
+
+    if (!*fromFile) {
+        *size = *kernelSourceSizes[which];
+        source_str = (char *)malloc(*size + 1);
+        if (source_str != NULL) {
+            memcpy(source_str, kernelSources[which], *size);
+            source_str[*size] = '\0';
+        }
+        return source_str;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, kernelFiles[which]);
+    fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    // sized from the file, so a big one isn't cut short
+    fseek(fp, 0, SEEK_END);
+    length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    *size = (length > 0) ? (size_t)length : 0;
+    source_str = (length >= 0) ? (char *)malloc(*size + 1) : NULL;
+    if (source_str == NULL || fread(source_str, 1, *size, fp) != *size) {
+        perror(path);
+        free(source_str);
+        fclose(fp);
+        return NULL;
+    }
+    source_str[*size] = '\0';
+    fclose(fp);
+    return source_str;
+}
+
+#ifdef LZSS_SPIRV
+/*
+ * Creates a program from the embedded SPIR-V, which skips parsing the
+ * source.  Returns NULL if the device doesn't take SPIR-V.
+ */
+static cl_program BuildIL(cl_engine_t *engine, kernel_id_t which,
+    const char *options)
+{
+    char *ilVersion;
+    cl_program program;
+    cl_int err;
+
+    ilVersion = GetInfoString(engine, CL_DEVICE_IL_VERSION, 0);
+    if (ilVersion == NULL || strstr(ilVersion, "SPIR-V") == NULL) {
+        free(ilVersion);
+        return NULL;
+    }
+    free(ilVersion);
+
+    program = clCreateProgramWithIL(engine->context, kernelIL[which], *kernelILSizes[which], &err);
+    if (err != CL_SUCCESS) {
+        return NULL;
+    }
+
+    err = clBuildProgram(program, 1, &engine->device, options, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    printf("Built %s from SPIR-V\n", kernelFiles[which]);
+    return program;
+}
+#endif
+
+// compiles a program from source, printing the build log
+static cl_program BuildSource(cl_engine_t *engine, const char *source_str,
+    size_t source_size, const char *options)
+{
+    cl_program program;
+    cl_int err;
+
+    program = clCreateProgramWithSource(engine->context, 1, &source_str, &source_size, &err);
+    if(err != CL_SUCCESS) {
+        perror("Problem creating program\n");
+        printf("Error Code: %d\n", err);
+        return NULL;
+    }
+
+    err = clBuildProgram(program, 1, &engine->device, options, NULL, NULL);
+    if(err != CL_SUCCESS) {
+        perror("Problem building program executable.\n");
+        printf("Error Code: %d\n", err);
+        if(err == CL_BUILD_PROGRAM_FAILURE) {
+            size_t log_siz;
+            clGetProgramBuildInfo(program, engine->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_siz);
+            char *log = (char *) malloc(log_siz);
+            clGetProgramBuildInfo(program, engine->device, CL_PROGRAM_BUILD_LOG, log_siz, log, NULL);
+            printf("%s\n", log);
+            free(log);
+        }
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    size_t len = 0;
+    clGetProgramBuildInfo(program, engine->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
+    char *buffer = calloc(len, sizeof(char));
+    clGetProgramBuildInfo(program, engine->device, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
+    printf("Build info\n%s\n", buffer);
+    free(buffer);
+
+    return program;
+}
+
+// returns a malloc'ed copy of a string valued device or platform query
+char *GetInfoString(cl_engine_t *engine, cl_uint param, int platform)
+{
+    size_t size = 0;
+    char *value;
+
+    if (platform) {
+        clGetPlatformInfo(engine->platform, param, 0, NULL, &size);
+    } else {
+        clGetDeviceInfo(engine->device, param, 0, NULL, &size);
+    }
+
+    value = (char *)calloc(size + 1, 1);
+    if (value == NULL) {
+        return NULL;
+    }
+
+    if (platform) {
+        clGetPlatformInfo(engine->platform, param, size, value, NULL);
+    } else {
+        clGetDeviceInfo(engine->device, param, size, value, NULL);
+    }
+
+    return value;
+}
+
+// 64 bit FNV-1a, continued from hash
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Works out the cache file for a program.  The name is a hash of the
+ * source, the build options, and the device, driver and platform
+ * versions, so a change to any of them misses the cache.  The directory
+ * is $LZSS_CL_CACHE, or lzss-opencl under $XDG_CACHE_HOME or ~/.cache.
+ * Setting LZSS_CL_CACHE to an empty string turns the cache off.
+ */
+static int CachePath(cl_engine_t *engine, const char *source,
+    size_t source_size, const char *options, char *path, size_t size)
+{
+    cl_uint deviceParams[3] = {CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    char dir[MAX_PATH_SIZE];
+    const char *env;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    char *value;
+
+    if ((env = getenv("LZSS_CL_CACHE")) != NULL) {
+        if (env[0] == '\0') {
+            return -1;
+        }
+        snprintf(dir, sizeof(dir), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/lzss-opencl", env);
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/lzss-opencl", env);
+    } else {
+        return -1;
+    }
+
+    if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0) {
+        return -1;
+    }
+
+    // the terminating zeros keep the fields apart
+    hash = HashBytes(hash, source, source_size);
+    hash = HashBytes(hash, options, strlen(options) + 1);
+
+    for (int i = 0; i < 3; i++) {
+        if ((value = GetInfoString(engine, deviceParams[i], 0)) == NULL) {
+            return -1;
+        }
+        hash = HashBytes(hash, value, strlen(value) + 1);
+        free(value);
+    }
+
+    if ((value = GetInfoString(engine, CL_PLATFORM_VERSION, 1)) == NULL) {
+        return -1;
+    }
+    hash = HashBytes(hash, value, strlen(value) + 1);
+    free(value);
+
+    if (snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long)hash) >= (int)size) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Creates a program from a cached binary.  Returns NULL if there is no
+ * cache file or the driver rejects it, the caller then builds the source.
+ */
+static cl_program LoadCachedProgram(cl_engine_t *engine, const char *path,
+    const char *options)
+{
+    FILE *fp;
+    unsigned char *binary;
+    size_t size;
+    cl_program program;
+    cl_int status, err;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    binary = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (binary == NULL || size == 0 || fread(binary, 1, size, fp) != size) {
+        free(binary);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    program = clCreateProgramWithBinary(engine->context, 1, &engine->device, &size,
+        (const unsigned char **)&binary, &status, &err);
+    free(binary);
+    if (err != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program != NULL) {
+            clReleaseProgram(program);
+        }
+        return NULL;
+    }
+
+    // binaries still have to be built, but this skips the compiler
+    err = clBuildProgram(program, 1, &engine->device, options, NULL, NULL);
+    if (err != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+/*
+ * Saves the device binary of a freshly built program.  It is written to a
+ * temporary file first, so a reader never sees a partly written binary.
+ */
+static void StoreProgramBinary(cl_engine_t *engine, cl_program program,
+    const char *path)
+{
+    char temp[MAX_PATH_SIZE];
+    unsigned char *binary;
+    size_t size = 0;
+    FILE *fp;
+    cl_int err;
+
+    (void)engine;
+
+    err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+    if (err != CL_SUCCESS || size == 0) {
+        return;
+    }
+
+    binary = (unsigned char *)malloc(size);
+    if (binary == NULL) {
+        return;
+    }
+
+    err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &binary, NULL);
+    if (err != CL_SUCCESS) {
+        free(binary);
+        return;
+    }
+
+    if (snprintf(temp, sizeof(temp), "%s.%ld", path, (long)getpid()) >= (int)sizeof(temp)) {
+        free(binary);
+        return;
+    }
+    fp = fopen(temp, "wb");
+    if (fp != NULL) {
+        if (fwrite(binary, 1, size, fp) == size && fclose(fp) == 0) {
+            rename(temp, path);
+        } else {
+            remove(temp);
+        }
+    }
+
+    free(binary);
+}
+
+/*
+ * Makes sure a device buffer holds at least bytes.  A buffer that is too
+ * small is replaced, one that is big enough is reused as is.
+ */
+static int ReserveBuffer(cl_engine_t *engine, cl_mem *buffer, size_t *size,
+    size_t bytes, cl_mem_flags flags)
+{
+    cl_int err;
+
+    if (*buffer != NULL && *size >= bytes) {
+        return 0;
+    }
+
+    if (*buffer != NULL) {
+        clReleaseMemObject(*buffer);
+        *buffer = NULL;
+        *size = 0;
+    }
+
+    *buffer = clCreateBuffer(engine->context, flags, bytes, NULL, &err);
+    if(err != CL_SUCCESS) {
+        perror("Problem creating buffer.\n");
+        printf("Error Code: %d\n", err);
+        *buffer = NULL;
+        return -1;
+    }
+
+    *size = bytes;
+    return 0;
+}
+
+int AllocBlocks(block_list_t *blocks, int no_of_blocks, size_t size)
+{
+    memset(blocks, 0, sizeof(*blocks));
+    blocks->no_of_blocks = no_of_blocks;
+    blocks->data = (unsigned char *)malloc(size ? size : 1);
+    blocks->offsets = (cl_uint *)calloc(no_of_blocks + 1, sizeof(cl_uint));
+    blocks->lengths = (cl_uint *)calloc(no_of_blocks ? no_of_blocks : 1, sizeof(cl_uint));
+
+    if (blocks->data == NULL || blocks->offsets == NULL || blocks->lengths == NULL) {
+        perror("Allocating blocks");
+        FreeBlocks(blocks);
+        return -1;
+    }
+
+    return 0;
+}
+
+void FreeBlocks(block_list_t *blocks)
+{
+    free(blocks->data);
+    free(blocks->offsets);
+    free(blocks->lengths);
+    blocks->data = NULL;
+    blocks->offsets = NULL;
+    blocks->lengths = NULL;
+}
+
+// maps a mapped block list's arrays for the host, setting its pointers
+static int MapBlocks(cl_engine_t *engine, block_list_t *blocks)
+{
+    void *ptr[NUM_BLOCK_ARRAYS];
+    cl_int err;
+
+    for (int i = 0; i < NUM_BLOCK_ARRAYS; i++) {
+        ptr[i] = clEnqueueMapBuffer(engine->queue[QUEUE_RUN], blocks->mem[i], CL_TRUE,
+            CL_MAP_READ | CL_MAP_WRITE, 0, blocks->memBytes[i], 0, NULL, NULL, &err);
+        if(err != CL_SUCCESS) {
+            perror("Problem mapping buffer.\n");
+            printf("Error Code: %d\n", err);
+            return -1;
+        }
+    }
+
+    blocks->data = (unsigned char *)ptr[BLOCK_DATA];
+    blocks->offsets = (cl_uint *)ptr[BLOCK_OFFSETS];
+    blocks->lengths = (cl_uint *)ptr[BLOCK_LENGTHS];
+    return 0;
+}
+
+// gives a mapped block list's arrays back to the device
+static int UnmapBlocks(cl_engine_t *engine, block_list_t *blocks)
+{
+    void *ptr[NUM_BLOCK_ARRAYS] = {blocks->data, blocks->offsets, blocks->lengths};
+    cl_int err = CL_SUCCESS;
+
+    for (int i = 0; i < NUM_BLOCK_ARRAYS; i++) {
+        if (ptr[i] != NULL) {
+            err |= clEnqueueUnmapMemObject(engine->queue[QUEUE_RUN], blocks->mem[i], ptr[i], 0, NULL, NULL);
+        }
+    }
+    blocks->data = NULL;
+    blocks->offsets = NULL;
+    blocks->lengths = NULL;
+
+    if(err != CL_SUCCESS) {
+        perror("Problem unmapping buffer.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int AllocMappedBlocks(cl_engine_t *engine, block_list_t *blocks,
+    int no_of_blocks, size_t size)
+{
+    cl_int err;
+
+    memset(blocks, 0, sizeof(*blocks));
+    blocks->no_of_blocks = no_of_blocks;
+    blocks->memBytes[BLOCK_DATA] = size ? size : 1;
+    blocks->memBytes[BLOCK_OFFSETS] = sizeof(cl_uint) * (no_of_blocks + 1);
+    blocks->memBytes[BLOCK_LENGTHS] = sizeof(cl_uint) * (no_of_blocks ? no_of_blocks : 1);
+
+    for (int i = 0; i < NUM_BLOCK_ARRAYS; i++) {
+        blocks->mem[i] = clCreateBuffer(engine->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+            blocks->memBytes[i], NULL, &err);
+        if(err != CL_SUCCESS) {
+            perror("Problem creating buffer.\n");
+            printf("Error Code: %d\n", err);
+            blocks->mem[i] = NULL;
+            FreeMappedBlocks(engine, blocks);
+            return -1;
+        }
+    }
+
+    if (MapBlocks(engine, blocks) != 0) {
+        FreeMappedBlocks(engine, blocks);
+        return -1;
+    }
+    return 0;
+}
+
+void FreeMappedBlocks(cl_engine_t *engine, block_list_t *blocks)
+{
+    UnmapBlocks(engine, blocks);
+    clFinish(engine->queue[QUEUE_RUN]);
+
+    for (int i = 0; i < NUM_BLOCK_ARRAYS; i++) {
+        if (blocks->mem[i] != NULL) {
+            clReleaseMemObject(blocks->mem[i]);
+            blocks->mem[i] = NULL;
+        }
+    }
+}
+
+/*
+ * Runs a kernel over all of in on the buffers behind it.  They are
+ * unmapped while the kernel has them and mapped again after, which on a
+ * device sharing the host's memory costs no copies.
+ */
+static int RunMapped(cl_engine_t *engine, kernel_id_t which,
+    block_list_t *in, block_list_t *out)
+{
+    cl_kernel kernel = engine->active->kernel[which];
+    unsigned int n = in->no_of_blocks;
+    size_t globalSize, localSize;
+    cl_event ran = NULL;
+    int result = 0;
+    cl_int err;
+
+    WorkSize(engine, which, n, &globalSize, &localSize);
+
+    if (UnmapBlocks(engine, in) != 0 || UnmapBlocks(engine, out) != 0) {
+        result = -1;
+    }
+
+    if (result == 0) {
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in->mem[BLOCK_DATA]);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &in->mem[BLOCK_OFFSETS]);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &out->mem[BLOCK_DATA]);
+        err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &out->mem[BLOCK_OFFSETS]);
+        err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &out->mem[BLOCK_LENGTHS]);
+        err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &n);
+        err |= clSetKernelArg(kernel, 6, sizeof(cl_mem), (engine->counters != NULL) ? &engine->counters : NULL);
+        if(err != CL_SUCCESS) {
+            perror("Problem setting arguments.\n");
+            printf("Error Code: %d\n", err);
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        err = clEnqueueNDRangeKernel(engine->queue[QUEUE_RUN], kernel, 1, NULL, &globalSize, &localSize, 0, NULL,
+            engine->profiling ? &ran : NULL);
+        if(err != CL_SUCCESS) {
+            perror("Problem enqueing kernel.\n");
+            printf("Error Code: %d\n", err);
+            result = -1;
+        }
+    }
+
+    // the maps wait for the kernel, the queue is in order
+    if (MapBlocks(engine, in) != 0 || MapBlocks(engine, out) != 0) {
+        result = -1;
+    }
+
+    if (ran != NULL) {
+        // nothing is copied, the kernel is all there is to profile
+        int phase = PHASE_KERNEL;
+        size_t bytes = in->offsets[n] - in->offsets[0];
+        event_list_t events = {&ran, &phase, &bytes, 1};
+
+        if (result == 0) {
+            ProfileEvents(engine, &events);
+        }
+        clReleaseEvent(ran);
+    }
+
+    for (unsigned int i = 0; result == 0 && i < n; i++) {
+        if (out->lengths[i] > out->offsets[i + 1] - out->offsets[i]) {
+            fprintf(stderr, "Block %d overflowed its output.\n", i);
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Work sizes for a run of n blocks.  Group kernels get a work-group per
+ * block, the others a work-item per block.  Work-groups are the size set
+ * for the kernel, or as large as the kernel can have if that is less.
+ */
+static void WorkSize(cl_engine_t *engine, kernel_id_t which, unsigned int n,
+    size_t *globalSize, size_t *localSize)
+{
+    size_t most;
+
+    *localSize = engine->localSize[which] ? engine->localSize[which] : LOCAL_SIZE;
+    if (clGetKernelWorkGroupInfo(engine->active->kernel[which], engine->device, CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(most), &most, NULL) == CL_SUCCESS && most < *localSize) {
+        *localSize = most;
+    }
+    if (kernelPerGroup[which]) {
+        *globalSize = n * *localSize;
+    } else {
+        *globalSize = ((n + *localSize - 1) / *localSize) * *localSize;
+    }
+}
+
+int ParseEncoder(const char *name)
+{
+    for (size_t i = 0; i < NUM_ENCODERS; i++) {
+        if (strcasecmp(name, encoders[i].name) == 0) {
+            return encoders[i].kernel;
+        }
+    }
+    return -1;
+}
+
+int ParseDecoder(const char *name)
+{
+    for (size_t i = 0; i < NUM_DECODERS; i++) {
+        if (strcasecmp(name, decoders[i].name) == 0) {
+            return decoders[i].kernel;
+        }
+    }
+    return -1;
+}
+
+const char *EncoderName(kernel_id_t which)
+{
+    for (size_t i = 0; i < NUM_ENCODERS; i++) {
+        if (encoders[i].kernel == which) {
+            return encoders[i].name;
+        }
+    }
+    return NULL;
+}
+
+const char *DecoderName(kernel_id_t which)
+{
+    for (size_t i = 0; i < NUM_DECODERS; i++) {
+        if (decoders[i].kernel == which) {
+            return decoders[i].name;
+        }
+    }
+    return NULL;
+}
+
+int SetLocalSize(cl_engine_t *engine, kernel_id_t which, size_t size)
+{
+    if (size > LOCAL_SIZE || (size & (size - 1)) != 0) {
+        fprintf(stderr, "Work-group size must be a power of 2 up to %d.\n", LOCAL_SIZE);
+        return -1;
+    }
+    engine->localSize[which] = size;
+    return 0;
+}
+
+static cl_event *NewEvent(event_list_t *events, phase_id_t phase, size_t bytes)
+{
+    // stays NULL if the command can't be queued
+    events->phase[events->count] = phase;
+    events->bytes[events->count] = bytes;
+    events->event[events->count] = NULL;
+    return &events->event[events->count++];
+}
+
+/*
+ * Queues the writes and kernel for count blocks starting at first, using
+ * the buffers of piece.  ran is set to the kernel's event.
+ */
+static int EnqueuePiece(cl_engine_t *engine, kernel_id_t which,
+    const block_list_t *in, block_list_t *out, int first, int count,
+    int piece, event_list_t *events, cl_event *ran)
+{
+    unsigned int n = count;
+    size_t bytes[NUM_BUFFERS];
+    cl_mem_flags flags[NUM_BUFFERS] = {CL_MEM_READ_ONLY, CL_MEM_READ_ONLY,
+        CL_MEM_WRITE_ONLY, CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY};
+    cl_kernel kernel = engine->active->kernel[which];
+    size_t globalSize, localSize;
+    cl_mem *buffer = engine->buffer[piece];
+    cl_event *written = events->event + events->count;
+    cl_uint numWritten;
+    cl_int err;
+
+    WorkSize(engine, which, n, &globalSize, &localSize);
+
+    bytes[BUFFER_IN] = in->offsets[first + count] - in->offsets[first];
+    bytes[BUFFER_IN_OFFSETS] = sizeof(cl_uint) * (count + 1);
+    bytes[BUFFER_OUT] = out->offsets[first + count] - out->offsets[first];
+    bytes[BUFFER_OUT_OFFSETS] = sizeof(cl_uint) * (count + 1);
+    bytes[BUFFER_OUT_LENGTHS] = sizeof(cl_uint) * count;
+
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        // zero sized buffers aren't allowed
+        if (ReserveBuffer(engine, &buffer[i], &engine->bufferBytes[piece][i],
+            bytes[i] ? bytes[i] : 1, flags[i]) != 0) {
+            return -1;
+        }
+    }
+
+    err = CL_SUCCESS;
+    if (bytes[BUFFER_IN] != 0) {
+        err = clEnqueueWriteBuffer(engine->queue[QUEUE_WRITE], buffer[BUFFER_IN], CL_FALSE, 0, bytes[BUFFER_IN], in->data + in->offsets[first], 0, NULL, NewEvent(events, PHASE_WRITE, bytes[BUFFER_IN]));
+    }
+    err |= clEnqueueWriteBuffer(engine->queue[QUEUE_WRITE], buffer[BUFFER_IN_OFFSETS], CL_FALSE, 0, bytes[BUFFER_IN_OFFSETS], in->offsets + first, 0, NULL, NewEvent(events, PHASE_WRITE, bytes[BUFFER_IN_OFFSETS]));
+    err |= clEnqueueWriteBuffer(engine->queue[QUEUE_WRITE], buffer[BUFFER_OUT_OFFSETS], CL_FALSE, 0, bytes[BUFFER_OUT_OFFSETS], out->offsets + first, 0, NULL, NewEvent(events, PHASE_WRITE, bytes[BUFFER_OUT_OFFSETS]));
+    if(err != CL_SUCCESS) {
+        perror("Problem enqueing writes.\n");
+        return -1;
+    }
+    numWritten = (events->event + events->count) - written;
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer[BUFFER_IN]);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffer[BUFFER_IN_OFFSETS]);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &buffer[BUFFER_OUT]);
+    err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &buffer[BUFFER_OUT_OFFSETS]);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &buffer[BUFFER_OUT_LENGTHS]);
+    err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &n);
+    err |= clSetKernelArg(kernel, 6, sizeof(cl_mem), (engine->counters != NULL) ? &engine->counters : NULL);
+    if(err != CL_SUCCESS) {
+        perror("Problem setting arguments.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+
+    err = clEnqueueNDRangeKernel(engine->queue[QUEUE_RUN], kernel, 1, NULL, &globalSize, &localSize, numWritten, written, NewEvent(events, PHASE_KERNEL, bytes[BUFFER_IN]));
+    if(err != CL_SUCCESS) {
+        perror("Problem enqueing kernel.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    *ran = events->event[events->count - 1];
+
+    return 0;
+}
+
+// queues the read of a piece's block lengths after ran, setting lengthsRead to its event
+static int ReadLengths(cl_engine_t *engine, block_list_t *out, int first,
+    int count, int piece, event_list_t *events, cl_event ran, cl_event *lengthsRead)
+{
+    size_t bytes = sizeof(cl_uint) * count;
+    cl_int err;
+
+    err = clEnqueueReadBuffer(engine->queue[QUEUE_READ], engine->buffer[piece][BUFFER_OUT_LENGTHS], CL_FALSE, 0, bytes, out->lengths + first, 1, &ran, NewEvent(events, PHASE_READ, bytes));
+    if(err != CL_SUCCESS) {
+        perror("Problem reading from buffer.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    *lengthsRead = events->event[events->count - 1];
+
+    return 0;
+}
+
+/*
+ * Unused room a read of output goes on over instead of starting another.
+ * Copying this much takes about as long as a command costs, so small
+ * blocks, like sub-blocks, are read a piece at a time and large ones
+ * apart.
+ */
+#define READ_GAP_BYTES 16384
+
+/*
+ * Waits for the block lengths of a piece, then queues the reads of only
+ * the part of each block's room that was used, joining blocks less than
+ * READ_GAP_BYTES apart into one read.  The writes and kernels
+ * queued so far are flushed first, so the device has them while the
+ * host waits.
+ */
+static int ReadPiece(cl_engine_t *engine, block_list_t *out, int first,
+    int count, int piece, event_list_t *events, cl_event lengthsRead)
+{
+    cl_mem buffer = engine->buffer[piece][BUFFER_OUT];
+    cl_int err;
+
+    err = clFlush(engine->queue[QUEUE_WRITE]);
+    err |= clFlush(engine->queue[QUEUE_RUN]);
+    err |= clWaitForEvents(1, &lengthsRead);
+    if(err != CL_SUCCESS) {
+        perror("Problem reading from buffer.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+
+    for (int i = first; i < first + count; i++) {
+        if (out->lengths[i] > out->offsets[i + 1] - out->offsets[i]) {
+            fprintf(stderr, "Block %d overflowed its output.\n", i);
+            return -1;
+        }
+    }
+
+    for (int i = first; i < first + count; ) {
+        size_t start = out->offsets[i];
+        size_t end = start + out->lengths[i];
+
+        // the room between the blocks is read too, nothing reads it after
+        for (i++; i < first + count && out->offsets[i] - end < READ_GAP_BYTES; i++) {
+            end = out->offsets[i] + out->lengths[i];
+        }
+        if (end == start) {
+            continue;
+        }
+
+        // the read queue is in order, these come after the lengths and before the next piece's
+        err = clEnqueueReadBuffer(engine->queue[QUEUE_READ], buffer, CL_FALSE, start - out->offsets[first], end - start, out->data + start, 0, NULL, NewEvent(events, PHASE_READ, end - start));
+        if(err != CL_SUCCESS) {
+            perror("Problem reading from buffer.\n");
+            printf("Error Code: %d\n", err);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// adds the time the events of a run took to the engine's totals
+static void ProfileEvents(cl_engine_t *engine, const event_list_t *events)
+{
+    cl_ulong start, end, first = 0, last = 0;
+
+    for (int i = 0; i < events->count; i++) {
+        if (clGetEventProfilingInfo(events->event[i], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+            clGetEventProfilingInfo(events->event[i], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS) {
+            continue;
+        }
+
+        engine->phaseTime[events->phase[i]] += end - start;
+        engine->phaseBytes[events->phase[i]] += events->bytes[i];
+        engine->phaseCommands[events->phase[i]]++;
+        if (first == 0 || start < first) {
+            first = start;
+        }
+        if (end > last) {
+            last = end;
+        }
+    }
+
+    engine->wallTime += last - first;
+}
+
+void ReportOverlap(const cl_engine_t *engine, FILE *fp)
+{
+    cl_ulong transferTime = engine->phaseTime[PHASE_WRITE] + engine->phaseTime[PHASE_READ];
+    double transfer = transferTime / 1e6;
+    double kernel = engine->phaseTime[PHASE_KERNEL] / 1e6;
+    double wall = engine->wallTime / 1e6;
+    double hidden = transfer + kernel - wall;
+
+    if (engine->queues == 1 || transferTime == 0) {
+        return;
+    }
+
+    if (hidden < 0) {
+        hidden = 0;
+    }
+    fprintf(fp, "Transfers %.2f ms, kernels %.2f ms, done in %.2f ms: %.0f%% of transfer time overlapped\n",
+        transfer, kernel, wall, 100.0 * hidden / transfer);
+}
+
+void ResetProfile(cl_engine_t *engine)
+{
+    for (int i = 0; i < NUM_PHASES; i++) {
+        engine->phaseTime[i] = 0;
+        engine->phaseBytes[i] = 0;
+        engine->phaseCommands[i] = 0;
+    }
+    engine->wallTime = 0;
+}
+
+int ReportProfile(cl_engine_t *engine, FILE *fp)
+{
+    static const char *phaseNames[NUM_PHASES] = {"write", "kernel", "read"};
+    char *name = GetInfoString(engine, CL_DEVICE_NAME, 0);
+
+    if (name == NULL) {
+        return -1;
+    }
+
+    // the name is the only string, it just needs its quotes escaped
+    fprintf(fp, "{\n  \"device\": \"");
+    for (char *c = name; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*c >= ' ') {
+            fputc(*c, fp);
+        }
+    }
+    free(name);
+
+    fprintf(fp, "\",\n  \"queues\": %d,\n  \"profiled\": %s,\n", engine->queues,
+        engine->profiling ? "true" : "false");
+    fprintf(fp, "  \"host\": {\"context_ms\": %.3f, \"build_ms\": %.3f},\n",
+        engine->contextTime / 1e6, engine->buildTime / 1e6);
+    fprintf(fp, "  \"phases\": {\n");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        // bytes per ns are GB/s
+        double rate = engine->phaseTime[i] ? (double)engine->phaseBytes[i] / engine->phaseTime[i] : 0;
+
+        fprintf(fp, "    \"%s\": {\"commands\": %llu, \"bytes\": %llu, \"ms\": %.3f, ", phaseNames[i],
+            (unsigned long long)engine->phaseCommands[i], (unsigned long long)engine->phaseBytes[i],
+            engine->phaseTime[i] / 1e6);
+        if (i == PHASE_KERNEL) {
+            fprintf(fp, "\"mb_per_s\": %.1f}", rate * 1000);
+        } else {
+            fprintf(fp, "\"gb_per_s\": %.3f}", rate);
+        }
+        fprintf(fp, (i < NUM_PHASES - 1) ? ",\n" : "\n");
+    }
+    fprintf(fp, "  },\n  \"wall_ms\": %.3f\n}\n", engine->wallTime / 1e6);
+
+    return 0;
+}
+
+// the counts are 64 bits as two 32 bit halves, low first
+#define COUNTER_WORDS (2 * NUM_COUNTERS)
+
+int CountKernels(cl_engine_t *engine, int on)
+{
+    cl_uint zero[COUNTER_WORDS] = {0};
+    cl_int err;
+
+    if (!on) {
+        if (engine->counters != NULL) {
+            clReleaseMemObject(engine->counters);
+            engine->counters = NULL;
+        }
+        return 0;
+    }
+
+    if (engine->counters == NULL) {
+        engine->counters = clCreateBuffer(engine->context, CL_MEM_READ_WRITE, sizeof(zero), NULL, &err);
+        if(err != CL_SUCCESS) {
+            perror("Problem creating counters.\n");
+            printf("Error Code: %d\n", err);
+            engine->counters = NULL;
+            return -1;
+        }
+    }
+
+    // queued with the kernels, so it lands before the next run
+    err = clEnqueueWriteBuffer(engine->queue[QUEUE_RUN], engine->counters, CL_TRUE, 0, sizeof(zero), zero, 0, NULL, NULL);
+    if(err != CL_SUCCESS) {
+        perror("Problem writing counters.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    return 0;
+}
+
+int ReadCounters(cl_engine_t *engine, cl_ulong counters[NUM_COUNTERS])
+{
+    cl_uint words[COUNTER_WORDS];
+    cl_int err;
+
+    if (engine->counters == NULL) {
+        memset(counters, 0, sizeof(cl_ulong) * NUM_COUNTERS);
+        return 0;
+    }
+
+    err = clEnqueueReadBuffer(engine->queue[QUEUE_RUN], engine->counters, CL_TRUE, 0, sizeof(words), words, 0, NULL, NULL);
+    if(err != CL_SUCCESS) {
+        perror("Problem reading counters.\n");
+        printf("Error Code: %d\n", err);
+        return -1;
+    }
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counters[i] = ((cl_ulong)words[2 * i + 1] << 32) | words[2 * i];
+    }
+    return 0;
+}
+
+int ReportCounters(cl_engine_t *engine, FILE *fp)
+{
+    cl_ulong counters[NUM_COUNTERS];
+
+    if (ReadCounters(engine, counters) != 0) {
+        return -1;
+    }
+
+    fprintf(fp, "Kernels: %llu tokens, %llu literals, %llu matches\n",
+        (unsigned long long)counters[COUNTER_TOKENS], (unsigned long long)counters[COUNTER_LITERALS],
+        (unsigned long long)counters[COUNTER_MATCHES]);
+    if (counters[COUNTER_COMPARED] != 0) {
+        fprintf(fp, "Kernels: %llu bytes compared, %.1f a token, at most %llu for one\n",
+            (unsigned long long)counters[COUNTER_COMPARED],
+            (double)counters[COUNTER_COMPARED] / (counters[COUNTER_TOKENS] ? counters[COUNTER_TOKENS] : 1),
+            (unsigned long long)counters[COUNTER_MAX_SCAN]);
+    }
+    return 0;
+}
+
+// the first block of piece p when count blocks from first are split into pieces
+static int PieceStart(int first, int count, int pieces, int p)
+{
+    return first + (int)((long)count * p / pieces);
+}
+
+/*
+ * The run is split into engine->pieces pieces.  Each piece's output is
+ * read once the next piece's writes and kernel are queued, and before
+ * the next piece's lengths are, so with three queues the writes of the
+ * next piece and the reads of the last one go on while a kernel runs.
+ * The run's first writes and last reads have no kernel to overlap, as a
+ * run returns only when its output is all read.
+ */
+int RunKernel(cl_engine_t *engine, kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int first, int count)
+{
+    int pieces = (count < engine->pieces) ? count : engine->pieces;
+    cl_event ran = NULL, lengthsRead[OVERLAP_PIECES];
+    event_list_t events;
+    int result = 0;
+    cl_int err;
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (engine->active->kernel[which] == NULL) {
+        cl_ulong started = HostTime();
+        int built = BuildKernel(engine, which);
+
+        engine->buildTime += HostTime() - started;
+        if (built != 0) {
+            return -1;
+        }
+    }
+
+    if (in->mem[BLOCK_DATA] != NULL && out->mem[BLOCK_DATA] != NULL &&
+        first == 0 && count == in->no_of_blocks) {
+        // mapping moves in's arrays, but leaves what is in them alone
+        return RunMapped(engine, which, (block_list_t *)in, out);
+    }
+
+    // 3 writes, a kernel and a read of the lengths per piece, at most a read per block
+    events.event = (cl_event *)malloc(sizeof(cl_event) * (5 * pieces + count));
+    events.phase = (int *)malloc(sizeof(int) * (5 * pieces + count));
+    events.bytes = (size_t *)malloc(sizeof(size_t) * (5 * pieces + count));
+    events.count = 0;
+    if (events.event == NULL || events.phase == NULL || events.bytes == NULL) {
+        perror("Allocating events");
+        free(events.event);
+        free(events.phase);
+        free(events.bytes);
+        return -1;
+    }
+
+    for (int p = 0; p <= pieces && result == 0; p++) {
+        int start = PieceStart(first, count, pieces, p);
+        int end = PieceStart(first, count, pieces, p + 1);
+
+        if (p < pieces) {
+            result = EnqueuePiece(engine, which, in, out, start, end - start, p, &events, &ran);
+        }
+        // the last piece's data reads go ahead of this one's lengths, which wait for its kernel
+        if (result == 0 && p > 0) {
+            int last = PieceStart(first, count, pieces, p - 1);
+
+            result = ReadPiece(engine, out, last, start - last, p - 1, &events, lengthsRead[p - 1]);
+        }
+        if (result == 0 && p < pieces) {
+            result = ReadLengths(engine, out, start, end - start, p, &events, ran, &lengthsRead[p]);
+        }
+    }
+
+    // even after a failure, nothing may still be using the host memory
+    for (int i = 0; i < engine->queues; i++) {
+        err = clFinish(engine->queue[i]);
+        if(err != CL_SUCCESS) {
+            perror("Problem with CL Finish.\n");
+            printf("Error Code: %d\n", err);
+            result = -1;
+        }
+    }
+
+    if (result == 0 && engine->profiling) {
+        ProfileEvents(engine, &events);
+    }
+
+    for (int i = 0; i < events.count; i++) {
+        if (events.event[i] != NULL) {
+            clReleaseEvent(events.event[i]);
+        }
+    }
+    free(events.event);
+    free(events.phase);
+    free(events.bytes);
+
+    return result;
+}
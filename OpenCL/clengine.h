@@ -0,0 +1,286 @@
+#ifndef _CLENGINE_H
+#define _CLENGINE_H
+
+#include <stdio.h>
+#include <CL/opencl.h>
+
+// defaults, a job may use a smaller window, shorter matches or other blocks
+#define WINDOWSIZE 4096
+#define BLOCKSIZE 102400
+#define MAX_UNCODED 2
+#define MAX_CODED ((1 << 4) + MAX_UNCODED)
+
+// smallest window the kernels take
+#define MIN_WINDOWSIZE 32
+
+// largest an encoded block can get, a flags byte for every 8 literals
+#define ENCODED_BOUND(len) ((len) + ((len) + 7) / 8)
+
+typedef enum
+{
+    BLOCK_DATA,
+    BLOCK_OFFSETS,
+    BLOCK_LENGTHS,
+    NUM_BLOCK_ARRAYS
+} block_array_t;
+
+/*
+ * Blocks of input or output packed back to back, as the kernels take them.
+ * Block i is lengths[i] bytes at data + offsets[i] with room up to
+ * offsets[i + 1].  Input is packed, so its lengths are the gaps between
+ * offsets; output gets the worst case room for each block.
+ *
+ * Mapped lists live in host memory allocated by OpenCL, and the kernels
+ * use it where it is instead of copies of it.
+ */
+typedef struct block_list_t
+{
+    unsigned char *data;
+    cl_uint *offsets;       // no_of_blocks + 1 entries
+    cl_uint *lengths;       // no_of_blocks entries
+    int no_of_blocks;
+    cl_mem mem[NUM_BLOCK_ARRAYS];       // the arrays' buffers, NULL if not mapped
+    size_t memBytes[NUM_BLOCK_ARRAYS];
+} block_list_t;
+
+typedef enum
+{
+    QUEUE_WRITE,
+    QUEUE_RUN,
+    QUEUE_READ,
+    NUM_QUEUES
+} queue_id_t;
+
+// pieces a run is split into when transfers overlap the kernels
+#define OVERLAP_PIECES 3
+
+// what the profiled commands of a run do
+typedef enum
+{
+    PHASE_WRITE,            // copies to the device
+    PHASE_KERNEL,
+    PHASE_READ,             // copies back
+    NUM_PHASES
+} phase_id_t;
+
+typedef enum
+{
+    BUFFER_IN,
+    BUFFER_IN_OFFSETS,
+    BUFFER_OUT,
+    BUFFER_OUT_OFFSETS,
+    BUFFER_OUT_LENGTHS,
+    NUM_BUFFERS
+} buffer_id_t;
+
+/*
+ * Kernels the engine can run.  The encode variants are all built from
+ * encode.cl and write the same format, so any of them can be paired with
+ * either decode kernel from decode.cl.  All but KERNEL_ENCODE_HASH write the
+ * same bytes too.
+ */
+typedef enum
+{
+    KERNEL_ENCODE,          // a work-item per block
+    KERNEL_DECODE,
+    KERNEL_ENCODE_GROUP,    // a work-group per block, window in local memory
+    KERNEL_ENCODE_HASH,     // a work-item per block, hash chains of 3 bytes
+    KERNEL_ENCODE_VECTOR,   // a work-item per block, compares 16 bytes at once
+    KERNEL_DECODE_GROUP,    // a work-group per block, a work-item per flag group
+    NUM_KERNELS
+} kernel_id_t;
+
+/*
+ * Sizes the kernels are compiled for, given to clBuildProgram as -D
+ * options so the kernels use constants instead of arguments.
+ */
+typedef struct kernel_params_t
+{
+    cl_uint windowSize;     // power of 2, MIN_WINDOWSIZE to WINDOWSIZE
+    cl_uint maxCoded;       // longest match, MAX_UNCODED + 1 to MAX_CODED
+} kernel_params_t;
+
+// kernels built for one kernel_params_t
+typedef struct cl_variant_t
+{
+    kernel_params_t params;
+    cl_program program[NUM_KERNELS];
+    cl_kernel kernel[NUM_KERNELS];
+} cl_variant_t;
+
+// variants an engine keeps built
+#define MAX_VARIANTS 4
+
+// work-items per work-group, and most a group kernel takes
+#define LOCAL_SIZE 256
+
+/*
+ * What the kernels count when the engine counts, in the order encode.cl
+ * and decode.cl keep them.  Host threads aren't counted.
+ */
+typedef enum
+{
+    COUNTER_TOKENS,         // literals and matches
+    COUNTER_LITERALS,
+    COUNTER_MATCHES,
+    COUNTER_COMPARED,       // window bytes compared looking for matches
+    COUNTER_MAX_SCAN,       // most bytes compared for one token
+    NUM_COUNTERS
+} counter_id_t;
+
+/*
+ * Which device to run on.  A type of 0 takes the first GPU and falls back
+ * to any device, so hosts without a GPU can use a CPU runtime, or with a
+ * device index counts all devices.  A platform of -1 searches every
+ * platform, a device of -1 takes the first device of the type on the
+ * platform.
+ */
+typedef struct cl_device_select_t
+{
+    cl_device_type type;
+    int platform;
+    int device;
+} cl_device_select_t;
+
+/*
+ * Everything needed to run the kernels.  The context and queues are set up
+ * once, each program is built the first time its kernel is run for a
+ * variant, and the device buffers only grow, so repeated calls skip all of
+ * the setup.
+ *
+ * With one queue every run is write, kernel, read in order.  With three,
+ * writes, kernels and reads each get a queue, linked by events, and a run
+ * is split into pieces with their own buffers.  So the next piece can be
+ * written and the last one read while a kernel runs.
+ */
+typedef struct cl_engine_t
+{
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_device_type type;
+    cl_uint units;          // compute units of the device
+    cl_bool unified;        // device and host share memory
+    cl_context context;
+    cl_command_queue queue[NUM_QUEUES];     // all the same with one queue
+    int queues;             // 1, or 3 to overlap transfers and kernels
+    int pieces;             // pieces a run is split into
+    cl_variant_t variant[MAX_VARIANTS];
+    int variants;           // variants in use
+    cl_variant_t *active;   // the one runs use
+    size_t localSize[NUM_KERNELS];      // work-group size of each, 0 for LOCAL_SIZE
+    cl_mem counters;        // what the kernels count, NULL if they don't
+    cl_mem buffer[OVERLAP_PIECES][NUM_BUFFERS];
+    size_t bufferBytes[OVERLAP_PIECES][NUM_BUFFERS];    // bytes allocated
+    int profiling;          // the queues time their commands
+    cl_ulong phaseTime[NUM_PHASES];     // ns of each phase's commands
+    cl_ulong phaseBytes[NUM_PHASES];    // bytes they copied, or kernels took in
+    cl_ulong phaseCommands[NUM_PHASES];
+    cl_ulong wallTime;      // ns from the first command to the last
+    cl_ulong contextTime;   // ns creating the context and queues, on the host
+    cl_ulong buildTime;     // ns building or loading programs, on the host
+} cl_engine_t;
+
+/*
+ * Parses a device selection of the form type, platform[:device] or
+ * type:platform[:device], where type is gpu, cpu, accelerator or all.
+ * NULL or "" selects the default.  Returns 0 for success.
+ */
+int ParseDeviceSelect(const char *spec, cl_device_select_t *select);
+
+// prints every platform and device with the selection that picks it
+int ListDevices(FILE *fp);
+
+/*
+ * Returns NULL if no device matches select, NULL selects the default.
+ * queues is 1 or 3, 0 uses 3 except for CPU devices, where the transfers
+ * are just copies.  Three queues are always profiled, to tell how far
+ * they overlap, and one is when profile is non-zero.
+ */
+cl_engine_t *CreateEngine(const cl_device_select_t *select, int queues,
+    int profile);
+void FreeEngine(cl_engine_t *engine);
+
+// returns 0 if the kernels can be built for params
+int CheckKernelParams(const kernel_params_t *params);
+
+/*
+ * Makes later runs use kernels built for params, NULL for the defaults.
+ * Each is built the first time it is run, and up to MAX_VARIANTS are kept
+ * built, so switching back is free.  Returns -1 if params aren't possible.
+ */
+int UseKernelParams(cl_engine_t *engine, const kernel_params_t *params);
+
+/*
+ * Returns the encode kernel named name: serial, group, hash or vector.
+ * Returns -1 for an unknown name.
+ */
+int ParseEncoder(const char *name);
+
+// the same for the decode kernels: serial or group
+int ParseDecoder(const char *name);
+
+// the names the two take, NULL for a kernel of the other kind
+const char *EncoderName(kernel_id_t which);
+const char *DecoderName(kernel_id_t which);
+
+/*
+ * Runs which with work-groups of size, a power of 2 up to LOCAL_SIZE, or
+ * 0 for LOCAL_SIZE.  Less is used if the device can't run that many.
+ * Returns -1 for other sizes.
+ */
+int SetLocalSize(cl_engine_t *engine, kernel_id_t which, size_t size);
+
+/*
+ * Returns a string parameter of the engine's device, or of its platform
+ * if platform is non-zero, NULL if it can't be read.  Free it after.
+ */
+char *GetInfoString(cl_engine_t *engine, cl_uint param, int platform);
+
+// prints how much of the transfer time the kernels hid, with three queues
+void ReportOverlap(const cl_engine_t *engine, FILE *fp);
+
+// starts the profiled times of the phases again, not the host's
+void ResetProfile(cl_engine_t *engine);
+
+/*
+ * Prints the time of each phase since ResetProfile as JSON, with GB/s for
+ * the copies and MB/s of input for the kernels, and the time creating the
+ * context and building programs.  Phases are only timed when profiling.
+ */
+int ReportProfile(cl_engine_t *engine, FILE *fp);
+
+/*
+ * Non-zero makes the kernels run after count what they do, zero stops
+ * them.  Counts start at zero.  The kernels add to the counts once per
+ * block with atomics, so counting costs little.  Returns 0 for success.
+ */
+int CountKernels(cl_engine_t *engine, int on);
+
+// reads the counts back, once the kernels have finished
+int ReadCounters(cl_engine_t *engine, cl_ulong counters[NUM_COUNTERS]);
+
+// prints the counts
+int ReportCounters(cl_engine_t *engine, FILE *fp);
+
+/*
+ * Allocates a block list of no_of_blocks blocks with room for size bytes
+ * of data.  Returns 0 for success.
+ */
+int AllocBlocks(block_list_t *blocks, int no_of_blocks, size_t size);
+void FreeBlocks(block_list_t *blocks);
+
+// the same for a mapped block list
+int AllocMappedBlocks(cl_engine_t *engine, block_list_t *blocks,
+    int no_of_blocks, size_t size);
+void FreeMappedBlocks(cl_engine_t *engine, block_list_t *blocks);
+
+/*
+ * Runs a kernel over count blocks of in starting at first, writing them to
+ * the same blocks of out.  Only the bytes in use go to and from the
+ * device, and nothing does when in and out are mapped and the run covers
+ * all of in.  Returns 0 for success.
+ */
+int RunKernel(cl_engine_t *engine, kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int first, int count);
+
+#endif
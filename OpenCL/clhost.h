@@ -0,0 +1,44 @@
+#ifndef CLHOST_H
+#define CLHOST_H
+
+/*
+ * Lets the OpenCL C kernels in encode.cl and decode.cl be compiled as plain
+ * host C, so the same code can be benchmarked and run on the CPU.  Include
+ * this before the .cl file and set clhost_global_id before calling a kernel;
+ * each host thread acts as a single work-item in a work-group of one.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define __kernel
+#define __global
+#define __local
+#define __private
+#define __constant const
+
+static _Thread_local size_t clhost_global_id;
+
+static inline size_t get_global_id(unsigned int dim) { (void)dim; return clhost_global_id; }
+static inline size_t get_group_id(unsigned int dim) { (void)dim; return clhost_global_id; }
+static inline size_t get_local_id(unsigned int dim) { (void)dim; return 0; }
+static inline size_t get_local_size(unsigned int dim) { (void)dim; return 1; }
+
+// a work-group of one has nobody to wait for
+#define CLK_LOCAL_MEM_FENCE 1
+#define CLK_GLOBAL_MEM_FENCE 2
+static inline void barrier(int flags) { (void)flags; }
+
+// the counters' atomics, host threads share what they count
+#define atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define atomic_inc(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+static inline unsigned int atomic_max(volatile unsigned int *p, unsigned int v)
+{
+    unsigned int old = *p;
+
+    while (old < v && !__atomic_compare_exchange_n(p, &old, v, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return old;
+}
+
+#endif
@@ -1,20 +1,49 @@
+/* the window the blocks were encoded with, passed with -D if not this */
+#ifndef WINDOW_SIZE
+#define WINDOW_SIZE 4096
+#endif
 #define MAX_UNCODED 2
 #define MAX_CODED ((1 << 4) + MAX_UNCODED)
-#define BLOCKSIZE 102400
 
 typedef struct encoded_string_t {
   unsigned int offset; /* offset to start of longest match */
   unsigned int length; /* length of longest match */
 } encoded_string_t;
 
-struct __attribute__((packed)) FIFO {
-  int id;
-  int len;
-  char string[BLOCKSIZE];
-};
+/* the counters of encode.cl, decoding only counts tokens */
+#define COUNT_TOKENS 0
+#define COUNT_LITERALS 1
+#define COUNT_MATCHES 2
 
-__kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *outfifo, const unsigned int n, const unsigned int windowsize)
-                            //unsigned char* slidingWindow, __local unsigned char* uncodedLookahead)
+void AddCounter(__global unsigned int *counter, unsigned int value)
+{
+    if (atomic_add(counter, value) + value < value) {
+        atomic_inc(counter + 1);
+    }
+}
+
+/* adds what a work-item decoded, counters may be NULL */
+void CountTokens(__global unsigned int *counters, unsigned int tokens, unsigned int literals)
+{
+    if (counters == NULL) {
+        return;
+    }
+    AddCounter(counters + 2 * COUNT_TOKENS, tokens);
+    AddCounter(counters + 2 * COUNT_LITERALS, literals);
+    AddCounter(counters + 2 * COUNT_MATCHES, tokens - literals);
+}
+
+/*
+ * Blocks are packed back to back.  Input block id is the bytes from
+ * inOffsets[id] to inOffsets[id + 1], its output goes at outOffsets[id]
+ * with room up to outOffsets[id + 1] and its length to outLengths[id].
+ * Offsets are relative to the first block's, so a run can start at any
+ * block of a file.  counters is NULL unless the host counts.
+ */
+__kernel void DecodeLZSS(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                         __global unsigned char *out, __global const unsigned int *outOffsets,
+                         __global unsigned int *outLengths, const unsigned int n,
+                         __global unsigned int *counters)
 {
     int id = get_global_id(0);
     int gid = get_group_id(0);
@@ -22,9 +51,14 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
 
     if(id < n) 
     {
+        __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+        unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+        __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
+        unsigned int outSize = outOffsets[id + 1] - outOffsets[id];
+
         /* cyclic buffer sliding window of already read characters */
-        unsigned char slidingWindow[4096];
-        unsigned char uncodedLookahead[18];
+        unsigned char slidingWindow[WINDOW_SIZE];
+        unsigned char uncodedLookahead[MAX_CODED];
 
         /************************************************************************
         * Fill the sliding window buffer with some known vales.  DecodeLZSS must
@@ -34,7 +68,7 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
         // memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
         //int tidx = get_local_id(0);
         #pragma unroll
-        for (int t = 0; t < windowsize; t ++) {
+        for (int t = 0; t < WINDOW_SIZE; t ++) {
             slidingWindow[t] = ' ';
         }
         //barrier(CLK_LOCAL_MEM_FENCE);
@@ -42,10 +76,12 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
 
         if(true)
         {
-            int c, read, len_out;
+            unsigned int c, read, len_out;
             unsigned char flags, flagsUsed;     /* encoded/not encoded flag */
             unsigned int i, nextChar;
             encoded_string_t code; /* offset/length code for string */
+            unsigned int tokens = 0;
+            unsigned int literals = 0;
 
             /* initialize variables */
             flags = 0;
@@ -54,7 +90,6 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
             read = 0;
             len_out = 0;
 
-            outfifo[id].id = id;
             while (true)
             {
                 flags >>= 1;
@@ -64,12 +99,11 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                 {
                     /* shifted out all the flag bits, read a new flag */
                     //if ((c = getc(inFile)) == EOF)
-                    //if ((c = infifo[gid].string[read]) == EOF)
-                    if(read >= infifo[id].len)
+                    if(read >= inLen)
                     {
                         break;
                     }
-                    c = infifo[id].string[read];
+                    c = input[read];
                     read++;
                     flags = c & 0xFF;
                     flagsUsed = 0;
@@ -78,19 +112,19 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                 if (flags & 0x01)
                 {
                     /* uncoded character */
-                    //if ((c = BitFileGetChar(bfpIn)) == EOF)
-                    //if ((c = infifo[gid].string[read]) == EOF)
-                    if (read >= infifo[id].len)
+                    if (read >= inLen || len_out >= outSize)
                     {
                         break;
                     }
-                    c = infifo[id].string[read];
+                    c = input[read];
                     read++;
                     /* write out byte and put it in sliding window */
                     //putc(c, fpOut);
-                    outfifo[id].string[len_out++] = c;
+                    output[len_out++] = c;
                     slidingWindow[nextChar] = c;
-                    nextChar = (nextChar + 1) % windowsize;
+                    nextChar = (nextChar + 1) % WINDOW_SIZE;
+                    tokens++;
+                    literals++;
                 }
                 else
                 {
@@ -99,19 +133,17 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                     code.length = 0;
 
                     /* offset and length */
-                    //if ((code.offset = infifo[gid].string[read]) == EOF)
-                    if(read >= infifo[id].len)
+                    if(read >= inLen)
                     {
                         break;
                     }
-                    code.offset = infifo[id].string[read];
+                    code.offset = input[read];
                     read++;
-                    //if ((code.length = infifo[gid].string[read]) == EOF)
-                    if(read >= infifo[id].len)
+                    if(read >= inLen)
                     {
                         break;
                     }
-                    code.length = infifo[id].string[read];
+                    code.length = input[read];
                     read++;
 
                     /* unpack offset and length */
@@ -120,6 +152,12 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                     code.offset |= ((code.length & 0x00F0) >> 4);
                     code.length = (code.length & 0x000F) + MAX_UNCODED + 1;
 
+                    /* corrupt data, the block can't be this long */
+                    if (len_out + code.length > outSize)
+                    {
+                        break;
+                    }
+
                     /****************************************************************
                     * Write out decoded string to file and lookahead.  It would be
                     * nice to write to the sliding window instead of the lookahead,
@@ -128,22 +166,263 @@ __kernel void DecodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                     ****************************************************************/
                     for (i = 0; i < code.length; i++)
                     {
-                        c = slidingWindow[(code.offset + i) % windowsize];
+                        c = slidingWindow[(code.offset + i) % WINDOW_SIZE];
                         //putc(c, fpOut);
-                        outfifo[id].string[len_out++] = c;
+                        output[len_out++] = c;
                         uncodedLookahead[i] = c;
                     }
 
                     /* write out decoded string to sliding window */
                     for (i = 0; i < code.length; i++)
                     {
-                        slidingWindow[(nextChar + i) % windowsize] = uncodedLookahead[i];
+                        slidingWindow[(nextChar + i) % WINDOW_SIZE] = uncodedLookahead[i];
+                    }
+
+                    nextChar = (nextChar + code.length) % WINDOW_SIZE;
+                    tokens++;
+                }
+            }
+            outLengths[id] = len_out;
+            CountTokens(counters, tokens, literals);
+        }
+    }
+}
+/* the most work-items DecodeLZSSGroup takes, a flag group each */
+#define GROUP_MAX_SIZE 256
+
+/* the most bytes GROUP_MAX_SIZE flag groups decode to */
+#define GROUP_MAX_OUT (GROUP_MAX_SIZE * 8 * MAX_CODED)
+
+/*
+ * Output position byte i of a match at pos is copied from.  It is the
+ * window as it was before the match, so negative positions are the spaces
+ * the window starts with.
+ */
+int MatchSource(unsigned int pos, unsigned int offset, unsigned int i)
+{
+    return (int)(pos + (offset + i + WINDOW_SIZE - pos % WINDOW_SIZE) % WINDOW_SIZE) - WINDOW_SIZE;
+}
+
+/*
+ * Whether every byte a match at pos copies is written: before the run,
+ * in the run with its bit in written set, or earlier in the work-item's
+ * own flag group from groupOut on.
+ */
+bool MatchReady(unsigned int pos, unsigned int offset, unsigned int length, unsigned int runOut,
+                unsigned int groupOut, __local const unsigned int *written)
+{
+    unsigned int i;
+
+    for (i = 0; i < length; i++) {
+        int src = MatchSource(pos, offset, i);
+
+        if (src >= (int)groupOut) {
+            continue;
+        }
+        if (src >= (int)runOut) {
+            unsigned int bit = src - runOut;
+
+            if (!(written[bit / 32] & (1u << (bit % 32)))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Same arguments as DecodeLZSS, but block id is decoded by work-group id
+ * in runs of a flag group per work-item.  The local size must not be more
+ * than GROUP_MAX_SIZE.
+ *
+ * First work-item 0 finds where each flag group of the run starts, which
+ * only takes the flag bytes.  Each work-item then reads its group's tokens,
+ * and a prefix sum of the groups' lengths gives where each one's output
+ * goes.  Literals are written at once.  Matches are copied in rounds, each
+ * round copying the matches whose source bytes are all written, in order
+ * within a group, so a match waits for the ones it copies from.
+ */
+__kernel void DecodeLZSSGroup(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                              __global unsigned char *out, __global const unsigned int *outOffsets,
+                              __global unsigned int *outLengths, const unsigned int n,
+                              __global unsigned int *counters)
+{
+    __local unsigned int groupStart[GROUP_MAX_SIZE + 1];
+    __local unsigned int groupEnd[GROUP_MAX_SIZE];
+    __local unsigned int written[GROUP_MAX_OUT / 32];
+    __local unsigned int runGroups;
+    __local unsigned int runEnd;
+    __local unsigned int more;
+    unsigned int id = get_group_id(0);
+    unsigned int lid = get_local_id(0);
+    unsigned int size = get_local_size(0);
+
+    if (id >= n) {
+        return;
+    }
+
+    __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+    unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+    __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
+    unsigned int outSize = outOffsets[id + 1] - outOffsets[id];
+    unsigned int tokenLength[8];
+    unsigned int tokenOffset[8];
+    unsigned int read = 0;
+    unsigned int len_out = 0;
+    unsigned int decoded = 0;
+    unsigned int literals = 0;
+    unsigned int i;
+    unsigned int k;
+
+    while (read < inLen) {
+        unsigned char flags = 0;
+        unsigned int tokens = 0;
+        unsigned int groupLen = 0;
+        unsigned int groupOut;
+        unsigned int total;
+        unsigned int pos;
+        unsigned int waiting = 0;
+
+        /* pass 1, where the groups of the run start */
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lid == 0) {
+            pos = read;
+            for (i = 0; i < size && pos < inLen; i++) {
+                groupStart[i] = pos;
+                pos += 1 + 16 - popcount((unsigned int)input[pos]);
+            }
+            groupStart[i] = pos;
+            runGroups = i;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        /* the complete tokens of this work-item's group, a cut off one ends the block */
+        if (lid < runGroups) {
+            unsigned int end = min(groupStart[lid + 1], inLen);
+
+            pos = groupStart[lid];
+            flags = input[pos++];
+            for (tokens = 0; tokens < 8; tokens++) {
+                if (flags & (1 << tokens)) {
+                    if (pos >= end) {
+                        break;
                     }
+                    tokenLength[tokens] = 1;
+                    pos++;
+                } else {
+                    if (pos + 2 > end) {
+                        break;
+                    }
+                    tokenOffset[tokens] = (input[pos] << 4) | (input[pos + 1] >> 4);
+                    tokenLength[tokens] = (input[pos + 1] & 0x0F) + MAX_UNCODED + 1;
+                    pos += 2;
+                }
+                groupLen += tokenLength[tokens];
+            }
+        }
+
+        /* prefix sum of the group lengths */
+        groupEnd[lid] = groupLen;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (k = 1; k < size; k <<= 1) {
+            unsigned int add = (lid >= k) ? groupEnd[lid - k] : 0;
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+            groupEnd[lid] += add;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        total = groupEnd[size - 1];
+        groupOut = len_out + groupEnd[lid] - groupLen;
+
+        if (lid == 0) {
+            runEnd = len_out + total;
+        }
+        for (i = lid; i < (total + 31) / 32; i += size) {
+            written[i] = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        /* the block ends before the first token that doesn't fit */
+        pos = groupOut;
+        for (i = 0; i < tokens; i++) {
+            if (pos + tokenLength[i] > outSize) {
+                atomic_min(&runEnd, pos);
+                break;
+            }
+            pos += tokenLength[i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        /* pass 2, literals go straight out */
+        pos = groupOut;
+        k = groupStart[lid] + 1;
+        for (i = 0; i < tokens && pos + tokenLength[i] <= runEnd; i++) {
+            decoded++;
+            if (flags & (1 << i)) {
+                output[pos] = input[k];
+                atomic_or(&written[(pos - len_out) / 32], 1u << ((pos - len_out) % 32));
+                literals++;
+                k++;
+            } else {
+                waiting |= 1 << i;
+                k += 2;
+            }
+            pos += tokenLength[i];
+        }
+
+        /* and matches in rounds */
+        while (true) {
+            unsigned int ready = 0;
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+            if (lid == 0) {
+                more = 0;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+            pos = groupOut;
+            for (i = 0; i < tokens && (waiting >> i); i++) {
+                if ((waiting & (1 << i)) &&
+                    !MatchReady(pos, tokenOffset[i], tokenLength[i], len_out, groupOut, written)) {
+                    break;
+                }
+                ready |= waiting & (1 << i);
+                pos += tokenLength[i];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            pos = groupOut;
+            for (i = 0; i < tokens && (ready >> i); i++) {
+                if (ready & (1 << i)) {
+                    for (k = 0; k < tokenLength[i]; k++) {
+                        int src = MatchSource(pos, tokenOffset[i], k);
 
-                    nextChar = (nextChar + code.length) % windowsize;
+                        output[pos + k] = (src < 0) ? ' ' : output[src];
+                        atomic_or(&written[(pos + k - len_out) / 32], 1u << ((pos + k - len_out) % 32));
+                    }
                 }
+                pos += tokenLength[i];
+            }
+            waiting &= ~ready;
+            if (waiting) {
+                more = 1;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+            if (!more) {
+                break;
             }
-            outfifo[id].len = len_out;
         }
+
+        /* a cut off group or a token that didn't fit ends the block */
+        read = groupStart[runGroups];
+        if (runEnd < len_out + total) {
+            read = inLen;
+        }
+        len_out = runEnd;
+    }
+
+    if (lid == 0) {
+        outLengths[id] = len_out;
     }
-}
\ No newline at end of file
+    CountTokens(counters, decoded, literals);
+}
@@ -1,17 +1,60 @@
+/*
+ * The host passes -D WINDOW_SIZE and -D MAX_CODED when a job's sizes
+ * aren't these, so the kernels are compiled for the sizes they run with.
+ * WINDOW_SIZE is a power of 2 up to 4096, MAX_CODED no more than the
+ * 4 bits of length can hold.
+ */
+#ifndef WINDOW_SIZE
+#define WINDOW_SIZE 4096
+#endif
 #define MAX_UNCODED 2
+#ifndef MAX_CODED
 #define MAX_CODED ((1 << 4) + MAX_UNCODED)
-#define BLOCKSIZE 102400
+#endif
 
 typedef struct encoded_string_t {
   unsigned int offset; /* offset to start of longest match */
   unsigned int length; /* length of longest match */
+  unsigned int compared; /* bytes compared finding it */
 } encoded_string_t;
 
-struct __attribute__((packed)) FIFO {
-  int id;
-  int len;
-  char string[BLOCKSIZE];
-};
+/*
+ * Counters the kernels add to when the host passes a counters buffer, in
+ * the order of counter_id_t on the host.  Each is 64 bits as two 32 bit
+ * halves, low first, as 64 bit atomics are an extension.  COUNT_MAX_SCAN
+ * is the most bytes compared for one token, in the low half.
+ */
+#define COUNT_TOKENS 0
+#define COUNT_LITERALS 1
+#define COUNT_MATCHES 2
+#define COUNT_COMPARED 3
+#define COUNT_MAX_SCAN 4
+
+void AddCounter(__global unsigned int *counter, unsigned long value)
+{
+    unsigned int low = (unsigned int)value;
+
+    if (atomic_add(counter, low) + low < low) {
+        atomic_inc(counter + 1);
+    }
+    if ((value >> 32) != 0) {
+        atomic_add(counter + 1, (unsigned int)(value >> 32));
+    }
+}
+
+/* adds what a work-item counted for its block, counters may be NULL */
+void CountBlock(__global unsigned int *counters, unsigned int tokens, unsigned int literals,
+                unsigned long compared, unsigned int longest)
+{
+    if (counters == NULL) {
+        return;
+    }
+    AddCounter(counters + 2 * COUNT_TOKENS, tokens);
+    AddCounter(counters + 2 * COUNT_LITERALS, literals);
+    AddCounter(counters + 2 * COUNT_MATCHES, tokens - literals);
+    AddCounter(counters + 2 * COUNT_COMPARED, compared);
+    atomic_max(counters + 2 * COUNT_MAX_SCAN, longest);
+}
 
 encoded_string_t FindMatch(const unsigned int windowHead, unsigned int uncodedHead, unsigned int windowsize, unsigned char* slidingWindow, unsigned char* uncodedLookahead) {
     encoded_string_t matchData;
@@ -20,11 +63,12 @@ encoded_string_t FindMatch(const unsigned int windowHead, unsigned int uncodedHe
 
     matchData.length = 0;
     matchData.offset = 0;
+    matchData.compared = 0;
     i = windowHead; /* start at the beginning of the sliding window */
     j = 0;
-    //printf("Entered findmatch\n");
 
     while (1) {
+        matchData.compared++;
         if (slidingWindow[i] == uncodedLookahead[uncodedHead]) 
         {
             /* we matched one. how many more match? */
@@ -37,6 +81,8 @@ encoded_string_t FindMatch(const unsigned int windowHead, unsigned int uncodedHe
                 }
                 j++;
             }
+            /* the loop compared j bytes, whichever way it ended */
+            matchData.compared += j;
 
             if (j > matchData.length) {
                 matchData.length = j;
@@ -62,18 +108,28 @@ encoded_string_t FindMatch(const unsigned int windowHead, unsigned int uncodedHe
  * Main encoding kernel
  */
 
-__kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *outfifo, const unsigned int n,const unsigned int windowsize) 
-                          //unsigned char* slidingWindow, unsigned char* uncodedLookahead) 
+/*
+ * Blocks are packed back to back.  Input block id is the bytes from
+ * inOffsets[id] to inOffsets[id + 1], its output goes at outOffsets[id]
+ * with room up to outOffsets[id + 1] and its length to outLengths[id].
+ * Offsets are relative to the first block's, so a run can start at any
+ * block of a file.  counters is NULL unless the host counts.
+ */
+__kernel void EncodeLZSS(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                         __global unsigned char *out, __global const unsigned int *outOffsets,
+                         __global unsigned int *outLengths, const unsigned int n,
+                         __global unsigned int *counters)
 {
-    //printf("kernel called\n");
     int id = get_global_id(0);
     int gid = get_group_id(0);
     int group_size = get_local_size(0);
     if (id < n) {
-        printf("Thread id %d\n",id);
+        __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+        unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+        __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
         /* cyclic buffer sliding window of already read characters */
-        unsigned char slidingWindow[4096];
-        unsigned char uncodedLookahead[18];
+        unsigned char slidingWindow[WINDOW_SIZE];
+        unsigned char uncodedLookahead[MAX_CODED];
 
         /************************************************************************
         * Fill the sliding window buffer with some known vales.  DecodeLZSS must
@@ -83,7 +139,7 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
         // memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
         //int tidx = get_local_id(0);
         #pragma unroll
-        for (int t = 0; t < windowsize; t ++) {
+        for (int t = 0; t < WINDOW_SIZE; t ++) {
             slidingWindow[t] = ' ';
         }
         //barrier(CLK_GLOBAL_MEM_FENCE);    
@@ -93,12 +149,8 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
         * buffer.
         ************************************************************************/
         //__local char out_array[BLOCKSIZE];
-        // TODO try using local array for output and use all threads to copy it back to outfifo
         if (true) {
-            //printf("group size %d\n", group_size);
-            //printf("1%c1%c2%s",slidingWindow[0], slidingWindow[1], slidingWindow);
             /* 8 code flags and encoded strings */
-            //printf("Thread %d\nInp len %d\n",id,infifo[id].len);
             unsigned char encodedData[16];
             unsigned char flags = 0;
             unsigned char flagPos = 0x01;
@@ -112,37 +164,34 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
             /* head of sliding window and lookahead */
             unsigned int uncodedHead = 0;
             unsigned int windowHead = 0;
-            //printf("Filling unencoded lookahead\n");
-            //for (len = 0; len < MAX_CODED && (c = infifo[gid].string[read]) != EOF; len++) {
-            for (len =0; len < MAX_CODED && read < infifo[id].len; len++)
+            unsigned int tokens = 0;
+            unsigned int literals = 0;
+            unsigned long compared = 0;
+            unsigned int longest = 0;
+            for (len =0; len < MAX_CODED && read < inLen; len++)
             {
-                c = infifo[id].string[read];
+                c = input[read];
                 uncodedLookahead[len] = c;
                 read++;
             }
-            //printf("Completed filling\n");
             if (len != 0) {
-                //printf("Calling find match\n");
-                matchData = FindMatch(windowHead, uncodedHead, windowsize, slidingWindow, uncodedLookahead);
-                //printf("find match returned\n");
+                matchData = FindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead);
 
-                outfifo[id].id = id;
                 /* now encoded the rest of the file until an EOF is read */
-                //printf("Entering while loop\n");
-                while (len > 0 && read < infifo[id].len) {
-                    //printf("Sliding window %c %c\n", slidingWindow[0], slidingWindow[1]);
-                    //printf("Length value: %d\nMatch len %d\nMatch off %d\n", len, matchData.length, matchData.offset);
+                while (len > 0) {
                     if (matchData.length > len) {
                         /* garbage beyond last data happened to extend match length */
                         matchData.length = len;
                     }
 
+                    tokens++;
+                    compared += matchData.compared;
+                    if (matchData.compared > longest) {
+                        longest = matchData.compared;
+                    }
                     if (matchData.length <= MAX_UNCODED) {
                         /* not long enough match.  write uncoded flag and character */
-                        //BitFilePutBit(UNCODED, bfpOut);
-                        //outfifo[gid].string[len_out++] = 1;
-                        //outfifo[gid].string[len_out++] = uncodedLookahead[uncodedHead];
-                        //BitFilePutChar(uncodedLookahead[uncodedHead], bfpOut);
+                        literals++;
                         matchData.length = 1; /* set to 1 for 1 byte uncoded */
                         flags |= flagPos;       /* mark with uncoded byte flag */
                         encodedData[nextEncoded++] = uncodedLookahead[uncodedHead];
@@ -153,11 +202,6 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                         //adjustedLen = matchData.length - (MAX_UNCODED + 1);
 
                         /* match length > MAX_UNCODED.  Encode as offset and length. */
-                        //BitFilePutBit(ENCODED, bfpOut);
-                        //BitFilePutBitsNum(bfpOut, &matchData.offset, OFFSET_BITS,sizeof(unsigned int));
-                        //BitFilePutBitsNum(bfpOut, &adjustedLen, LENGTH_BITS,sizeof(unsigned int));
-                        //outfifo[gid].string[len_out++] = (unsigned char)matchData.length;
-                        //outfifo[gid].string[len_out++] = (unsigned char)matchData.offset;
                         encodedData[nextEncoded++] = (unsigned char)((matchData.offset & 0x0FFF) >> 4);
                         encodedData[nextEncoded++] = (unsigned char)(((matchData.offset & 0x000F) << 4) |(matchData.length - (MAX_UNCODED + 1)));
                     }
@@ -166,14 +210,12 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                     {
                         /* we have 8 code flags, write out flags and code buffer */
                         //putc(flags, outFile);
-                        outfifo[id].string[len_out++] = flags;
-                        if(len_out < 12 && id == 0) printf("%c=%d(fl) ",flags,flags);
+                        output[len_out++] = flags;
                         for (i = 0; i < nextEncoded; i++)
                         {
                             /* send at most 8 units of code together */
                             //putc(encodedData[i], outFile);
-                            outfifo[id].string[len_out++] = encodedData[i];
-                            if(len_out < 12 && id == 0) printf("%c=%d(ed) ",encodedData[i],encodedData[i]);
+                            output[len_out++] = encodedData[i];
                         }
                         /* reset encoded data buffer */
                         flags = 0;
@@ -190,50 +232,681 @@ __kernel void EncodeLZSS(__global struct FIFO *infifo, __global struct FIFO *out
                     * Replace the matchData.length worth of bytes we've matched in the
                     * sliding window with new bytes from the input file.
                     ********************************************************************/
-                    //printf("Entering loop within loop\n");
                     i = 0;
-                    //while ((i < matchData.length) && ((c = infifo[gid].string[read]) != EOF)) {
-                    while ((i < matchData.length) && read < infifo[id].len)
+                    while ((i < matchData.length) && read < inLen)
                     {
-                        c = infifo[id].string[read];
+                        c = input[read];
                         /* add old byte into sliding window and new into lookahead */
                         slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
                         uncodedLookahead[uncodedHead] = c;
-                        windowHead = (windowHead + 1) % windowsize;
+                        windowHead = (windowHead + 1) % WINDOW_SIZE;
                         uncodedHead = (uncodedHead + 1) % MAX_CODED;
                         i++;
                         read++;
                     }
-                    //printf("Entering loop within loop 2\n");
                     /* handle case where we hit EOF before filling lookahead */
                     while (i < matchData.length) {
                         slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
                         /* nothing to add to lookahead here */
-                        windowHead = (windowHead + 1) % windowsize;
+                        windowHead = (windowHead + 1) % WINDOW_SIZE;
                         uncodedHead = (uncodedHead + 1) % MAX_CODED;
                         len--;
                         i++;
                     }
 
                     /* find match for the remaining characters */
-                    matchData = FindMatch(windowHead, uncodedHead, windowsize, slidingWindow, uncodedLookahead);
+                    matchData = FindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead);
                 }
 
                 /* write out any remaining encoded data */
                 if (nextEncoded != 0)
                 {
                     //putc(flags, outFile);
-                    outfifo[id].string[len_out++] = flags;
-                    if(len_out < 12 && id == 0) printf("%c=%d(flag) ",flags,flags);
+                    output[len_out++] = flags;
                     for (i = 0; i < nextEncoded; i++)
                     {
                         //putc(encodedData[i], outFile);
-                        outfifo[id].string[len_out++] = encodedData[i];
-                        if(len_out < 12 && id == 0) printf("%c=%d(ed) ",encodedData[i],encodedData[i]);
+                        output[len_out++] = encodedData[i];
+                    }
+                }
+            }
+            outLengths[id] = len_out;
+            CountBlock(counters, tokens, literals, compared, longest);
+        }
+    }
+}
+
+/*
+ * Work-group variant of EncodeLZSS, selected on the host as
+ * KERNEL_ENCODE_GROUP.  A whole work-group encodes one block, keeping the
+ * window and lookahead in local memory.  For each token every work-item
+ * checks every get_local_size(0)th window position, and the group reduces
+ * the candidates to the best one.  Ties go to the position FindMatch would
+ * reach first, so the output is byte for byte the same as EncodeLZSS's.
+ * The same reduction adds up what the work-items compared, so every
+ * work-item gets the group's count for the token.
+ */
+#define GROUP_MAX_SIZE 256
+
+encoded_string_t GroupFindMatch(const unsigned int windowHead, unsigned int uncodedHead, unsigned int windowsize,
+                                __local unsigned char *slidingWindow, __local unsigned char *uncodedLookahead,
+                                __local unsigned int *bestLength, __local unsigned int *bestIndex,
+                                __local unsigned int *groupCompared)
+{
+    encoded_string_t matchData;
+    unsigned int lid = get_local_id(0);
+    unsigned int size = get_local_size(0);
+    unsigned int length = 0;
+    unsigned int index = 0;
+    unsigned int k;
+    unsigned int j;
+
+    /* this work-item's share, the group's total once reduced */
+    matchData.compared = 0;
+
+    /* candidates are numbered from windowHead, the order FindMatch tries them */
+    for (k = lid; k < windowsize && length < MAX_CODED; k += size) {
+        unsigned int i = (windowHead + k) % windowsize;
+
+        j = 0;
+        while (j < MAX_CODED && slidingWindow[(i + j) % windowsize] == uncodedLookahead[(uncodedHead + j) % MAX_CODED]) {
+            j++;
+        }
+        matchData.compared += (j < MAX_CODED) ? j + 1 : j;
+
+        if (j > length) {
+            length = j;
+            index = k;
+        }
+    }
+
+    bestLength[lid] = length;
+    bestIndex[lid] = index;
+    groupCompared[lid] = matchData.compared;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (k = 1; k < size; k <<= 1) {
+        if ((lid & ((k << 1) - 1)) == 0 && lid + k < size) {
+            groupCompared[lid] += groupCompared[lid + k];
+            if (bestLength[lid + k] > bestLength[lid] ||
+                (bestLength[lid + k] == bestLength[lid] && bestIndex[lid + k] < bestIndex[lid])) {
+                bestLength[lid] = bestLength[lid + k];
+                bestIndex[lid] = bestIndex[lid + k];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    matchData.length = bestLength[0];
+    matchData.offset = (windowHead + bestIndex[0]) % windowsize;
+    matchData.compared = groupCompared[0];
+    return matchData;
+}
+
+/*
+ * Same arguments as EncodeLZSS, but block id is encoded by work-group id.
+ * The local size must not be more than GROUP_MAX_SIZE.  Every work-item
+ * follows the heads and lengths, work-item 0 alone writes the window and
+ * the output.
+ */
+__kernel void EncodeLZSSGroup(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                              __global unsigned char *out, __global const unsigned int *outOffsets,
+                              __global unsigned int *outLengths, const unsigned int n,
+                              __global unsigned int *counters)
+{
+    __local unsigned char slidingWindow[WINDOW_SIZE];
+    __local unsigned char uncodedLookahead[MAX_CODED];
+    __local unsigned int bestLength[GROUP_MAX_SIZE];
+    __local unsigned int bestIndex[GROUP_MAX_SIZE];
+    __local unsigned int groupCompared[GROUP_MAX_SIZE];
+    unsigned int id = get_group_id(0);
+    unsigned int lid = get_local_id(0);
+
+    if (id >= n) {
+        return;
+    }
+
+    __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+    unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+    __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
+    unsigned char encodedData[16];
+    unsigned char flags = 0;
+    unsigned char flagPos = 0x01;
+    int nextEncoded = 0;
+    encoded_string_t matchData;
+    unsigned int read = 0;
+    int len_out = 0;
+    unsigned int i;
+    int len;
+    unsigned int uncodedHead = 0;
+    unsigned int windowHead = 0;
+    unsigned int tokens = 0;
+    unsigned int literals = 0;
+    unsigned long compared = 0;
+    unsigned int longest = 0;
+
+    /* the same known values as EncodeLZSS */
+    for (i = lid; i < WINDOW_SIZE; i += get_local_size(0)) {
+        slidingWindow[i] = ' ';
+    }
+
+    for (len = 0; len < MAX_CODED && read < inLen; len++) {
+        if (lid == 0) {
+            uncodedLookahead[len] = input[read];
+        }
+        read++;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (len == 0) {
+        if (lid == 0) {
+            outLengths[id] = 0;
+        }
+        return;
+    }
+
+    matchData = GroupFindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead, bestLength, bestIndex, groupCompared);
+
+    while (len > 0) {
+        if (matchData.length > len) {
+            /* garbage beyond last data happened to extend match length */
+            matchData.length = len;
+        }
+
+        tokens++;
+        compared += matchData.compared;
+        if (matchData.compared > longest) {
+            longest = matchData.compared;
+        }
+        if (matchData.length <= MAX_UNCODED) {
+            /* not long enough match.  write uncoded flag and character */
+            literals++;
+            matchData.length = 1;
+            flags |= flagPos;
+            encodedData[nextEncoded++] = uncodedLookahead[uncodedHead];
+        } else {
+            encodedData[nextEncoded++] = (unsigned char)((matchData.offset & 0x0FFF) >> 4);
+            encodedData[nextEncoded++] = (unsigned char)(((matchData.offset & 0x000F) << 4) | (matchData.length - (MAX_UNCODED + 1)));
+        }
+
+        if (flagPos == 0x80) {
+            /* we have 8 code flags, write out flags and code buffer */
+            if (lid == 0) {
+                output[len_out] = flags;
+                for (i = 0; i < nextEncoded; i++) {
+                    output[len_out + 1 + i] = encodedData[i];
+                }
+            }
+            len_out += 1 + nextEncoded;
+            flags = 0;
+            flagPos = 0x01;
+            nextEncoded = 0;
+        } else {
+            flagPos <<= 1;
+        }
+
+        /* everyone has read the lookahead before work-item 0 replaces it */
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        /* replace the matched bytes in the window with new bytes from the input */
+        i = 0;
+        while ((i < matchData.length) && read < inLen) {
+            if (lid == 0) {
+                slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
+                uncodedLookahead[uncodedHead] = input[read];
+            }
+            windowHead = (windowHead + 1) % WINDOW_SIZE;
+            uncodedHead = (uncodedHead + 1) % MAX_CODED;
+            i++;
+            read++;
+        }
+
+        /* handle case where we hit the end before filling lookahead */
+        while (i < matchData.length) {
+            if (lid == 0) {
+                slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
+            }
+            windowHead = (windowHead + 1) % WINDOW_SIZE;
+            uncodedHead = (uncodedHead + 1) % MAX_CODED;
+            len--;
+            i++;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        matchData = GroupFindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead, bestLength, bestIndex, groupCompared);
+    }
+
+    /* write out any remaining encoded data */
+    if (lid == 0) {
+        if (nextEncoded != 0) {
+            output[len_out++] = flags;
+            for (i = 0; i < nextEncoded; i++) {
+                output[len_out++] = encodedData[i];
+            }
+        }
+        outLengths[id] = len_out;
+    }
+
+    /* every work-item has the group's counts, they are added once */
+    if (lid == 0) {
+        CountBlock(counters, tokens, literals, compared, longest);
+    }
+}
+
+/*
+ * Hash chain variant of EncodeLZSS, selected on the host as
+ * KERNEL_ENCODE_HASH.  Every byte put in the window starts a chain entry
+ * for the 3 bytes from it, and only the newest MAX_CHAIN window positions
+ * on the lookahead's chain are tried, so the cost of a token doesn't grow
+ * with the window.  Matches are still checked against the window byte by
+ * byte and DecodeLZSS decodes them, but they aren't always the ones
+ * EncodeLZSS finds.
+ *
+ * The window, head and chain take about 14 KB per work-item, which a GPU
+ * keeps in scratch memory, so this is meant for CPU devices.
+ */
+#define HASH_BITS 10
+#define HASH_SIZE (1 << HASH_BITS)
+#define MAX_CHAIN 64
+
+#define Hash3(a, b, c) (((((a) << 16) | ((b) << 8) | (c)) * 2654435761u) >> (32 - HASH_BITS))
+
+/*
+ * head holds 1 + the newest position of each hash, counting every byte
+ * put in the window, or 0.  Positions are kept to 16 bits, which is
+ * plenty to tell how far back they are in a window of at most 4096.  An
+ * entry left from 64 KB ago may look recent, but every candidate is
+ * checked against the window, so that only costs a comparison.  chain
+ * holds, by window index, how far back the position before it on the
+ * same chain is, or 0 if it has gone.
+ */
+encoded_string_t HashFindMatch(unsigned int written, unsigned int uncodedHead, unsigned int windowsize,
+                               unsigned char *slidingWindow, unsigned char *uncodedLookahead,
+                               unsigned short *head, unsigned short *chain)
+{
+    encoded_string_t matchData;
+    unsigned int hash = Hash3(uncodedLookahead[uncodedHead], uncodedLookahead[(uncodedHead + 1) % MAX_CODED],
+                              uncodedLookahead[(uncodedHead + 2) % MAX_CODED]);
+    unsigned int pos = head[hash];
+    unsigned int depth;
+    unsigned int i;
+    unsigned int j;
+
+    matchData.length = 0;
+    matchData.offset = 0;
+    matchData.compared = 0;
+
+    /* positions more than a window back have been written over */
+    for (depth = 0; pos != 0 && (unsigned short)(written - (pos - 1)) <= windowsize && depth < MAX_CHAIN; depth++) {
+        i = (pos - 1) % windowsize;
+
+        j = 0;
+        while (j < MAX_CODED && slidingWindow[(i + j) % windowsize] == uncodedLookahead[(uncodedHead + j) % MAX_CODED]) {
+            j++;
+        }
+        matchData.compared += (j < MAX_CODED) ? j + 1 : j;
+
+        if (j > matchData.length) {
+            matchData.length = j;
+            matchData.offset = i;
+            if (j >= MAX_CODED) {
+                break;
+            }
+        }
+
+        if (chain[i] == 0) {
+            break;
+        }
+        pos = (unsigned short)(pos - chain[i]);
+    }
+
+    return matchData;
+}
+
+__kernel void EncodeLZSSHash(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                             __global unsigned char *out, __global const unsigned int *outOffsets,
+                             __global unsigned int *outLengths, const unsigned int n,
+                             __global unsigned int *counters)
+{
+    unsigned int id = get_global_id(0);
+
+    if (id >= n) {
+        return;
+    }
+
+    __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+    unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+    __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
+    unsigned char slidingWindow[WINDOW_SIZE];
+    unsigned char uncodedLookahead[MAX_CODED];
+    unsigned short head[HASH_SIZE];
+    unsigned short chain[WINDOW_SIZE];
+    unsigned char encodedData[16];
+    unsigned char flags = 0;
+    unsigned char flagPos = 0x01;
+    int nextEncoded = 0;
+    encoded_string_t matchData;
+    unsigned int read = 0;
+    unsigned int written = 0;
+    int len_out = 0;
+    unsigned int i;
+    int len;
+    unsigned int uncodedHead = 0;
+    unsigned int windowHead = 0;
+    unsigned int tokens = 0;
+    unsigned int literals = 0;
+    unsigned long compared = 0;
+    unsigned int longest = 0;
+
+    /* the same known values as EncodeLZSS, but not on any chain */
+    for (i = 0; i < WINDOW_SIZE; i++) {
+        slidingWindow[i] = ' ';
+    }
+    for (i = 0; i < HASH_SIZE; i++) {
+        head[i] = 0;
+    }
+
+    for (len = 0; len < MAX_CODED && read < inLen; len++) {
+        uncodedLookahead[len] = input[read++];
+    }
+
+    if (len == 0) {
+        outLengths[id] = 0;
+        return;
+    }
+
+    matchData = HashFindMatch(written, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead, head, chain);
+
+    while (len > 0) {
+        if (matchData.length > len) {
+            /* garbage beyond last data happened to extend match length */
+            matchData.length = len;
+        }
+
+        tokens++;
+        compared += matchData.compared;
+        if (matchData.compared > longest) {
+            longest = matchData.compared;
+        }
+        if (matchData.length <= MAX_UNCODED) {
+            /* not long enough match.  write uncoded flag and character */
+            literals++;
+            matchData.length = 1;
+            flags |= flagPos;
+            encodedData[nextEncoded++] = uncodedLookahead[uncodedHead];
+        } else {
+            encodedData[nextEncoded++] = (unsigned char)((matchData.offset & 0x0FFF) >> 4);
+            encodedData[nextEncoded++] = (unsigned char)(((matchData.offset & 0x000F) << 4) | (matchData.length - (MAX_UNCODED + 1)));
+        }
+
+        if (flagPos == 0x80) {
+            /* we have 8 code flags, write out flags and code buffer */
+            output[len_out++] = flags;
+            for (i = 0; i < nextEncoded; i++) {
+                output[len_out++] = encodedData[i];
+            }
+            flags = 0;
+            flagPos = 0x01;
+            nextEncoded = 0;
+        } else {
+            flagPos <<= 1;
+        }
+
+        /* move the matched bytes into the window, chaining each one */
+        for (i = 0; i < matchData.length; i++) {
+            unsigned int hash = Hash3(uncodedLookahead[uncodedHead], uncodedLookahead[(uncodedHead + 1) % MAX_CODED],
+                                      uncodedLookahead[(uncodedHead + 2) % MAX_CODED]);
+            unsigned int back = (unsigned short)(written - (head[hash] - 1));
+
+            chain[windowHead] = (head[hash] != 0 && back < WINDOW_SIZE) ? back : 0;
+            /* a position that wraps to 0 only drops off its chain */
+            head[hash] = (unsigned short)++written;
+
+            slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
+            if (read < inLen) {
+                uncodedLookahead[uncodedHead] = input[read++];
+            } else {
+                /* nothing to add to lookahead here */
+                len--;
+            }
+            windowHead = (windowHead + 1) % WINDOW_SIZE;
+            uncodedHead = (uncodedHead + 1) % MAX_CODED;
+        }
+
+        matchData = HashFindMatch(written, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead, head, chain);
+    }
+
+    /* write out any remaining encoded data */
+    if (nextEncoded != 0) {
+        output[len_out++] = flags;
+        for (i = 0; i < nextEncoded; i++) {
+            output[len_out++] = encodedData[i];
+        }
+    }
+    outLengths[id] = len_out;
+    CountBlock(counters, tokens, literals, compared, longest);
+}
+
+#ifdef __OPENCL_VERSION__
+/*
+ * Vector variant of EncodeLZSS, selected on the host as
+ * KERNEL_ENCODE_VECTOR.  The first WINDOW_MIRROR bytes of the window are
+ * copied after its end, so 32 bytes from any window index load without
+ * wrapping.  Window positions are screened 16 at a time for the
+ * lookahead's first byte and matches are compared 16 bytes at a time.
+ * Positions are tried in FindMatch's order, so the output is the same as
+ * EncodeLZSS's.  Only built for devices, the host runs EncodeLZSS.
+ */
+#define WINDOW_MIRROR 32
+
+/*
+ * index of the first zero byte of a word of 0x00 and 0xFF bytes, which
+ * is the lowest byte on a little endian device and the highest on a big
+ */
+unsigned int FirstZeroByte(unsigned int same)
+{
+    unsigned int differ = ~same;
+
+#ifdef __ENDIAN_LITTLE__
+    return (31 - clz(differ & -differ)) >> 3;
+#else
+    return clz(differ) >> 3;
+#endif
+}
+
+/* number of equal bytes at the start of a and b */
+unsigned int LeadingEqual(uchar16 a, uchar16 b)
+{
+    uint4 same = as_uint4(a == b);
+
+    if (same.s0 != 0xFFFFFFFF) {
+        return FirstZeroByte(same.s0);
+    }
+    if (same.s1 != 0xFFFFFFFF) {
+        return 4 + FirstZeroByte(same.s1);
+    }
+    if (same.s2 != 0xFFFFFFFF) {
+        return 8 + FirstZeroByte(same.s2);
+    }
+    if (same.s3 != 0xFFFFFFFF) {
+        return 12 + FirstZeroByte(same.s3);
+    }
+    return 16;
+}
+
+encoded_string_t VectorFindMatch(const unsigned int windowHead, unsigned int uncodedHead, unsigned int windowsize,
+                                 unsigned char *slidingWindow, unsigned char *uncodedLookahead)
+{
+    encoded_string_t matchData;
+    unsigned char look[32];
+    uchar16 look0, look1;
+    unsigned int start = windowHead;
+    unsigned int end = windowsize;
+    unsigned int base;
+    unsigned int i;
+    unsigned int j;
+
+    matchData.length = 0;
+    matchData.offset = 0;
+    matchData.compared = 0;
+
+    /* the lookahead in order, the bytes past it never count */
+    for (j = 0; j < 32; j++) {
+        look[j] = (j < MAX_CODED) ? uncodedLookahead[(uncodedHead + j) % MAX_CODED] : 0;
+    }
+    look0 = vload16(0, look);
+    look1 = vload16(1, look);
+
+    /* from windowHead to the end of the window, then from its start */
+    for (int pass = 0; pass < 2; pass++) {
+        for (base = start; base < end; base += 16) {
+            /* counted by the vector, 16 bytes a compare */
+            matchData.compared += 16;
+            if (!any(vload16(0, slidingWindow + base) == look[0])) {
+                continue;
+            }
+
+            for (i = base; i < base + 16 && i < end; i++) {
+                if (slidingWindow[i] != look[0]) {
+                    continue;
+                }
+
+                j = LeadingEqual(vload16(0, slidingWindow + i), look0);
+                matchData.compared += 16;
+                if (j == 16) {
+                    j += LeadingEqual(vload16(1, slidingWindow + i), look1);
+                    matchData.compared += 16;
+                }
+                if (j > MAX_CODED) {
+                    j = MAX_CODED;
+                }
+
+                if (j > matchData.length) {
+                    matchData.length = j;
+                    matchData.offset = i;
+                    if (j == MAX_CODED) {
+                        return matchData;
                     }
                 }
-                outfifo[id].len = len_out;
             }
         }
+        start = 0;
+        end = windowHead;
+    }
+
+    return matchData;
+}
+
+__kernel void EncodeLZSSVector(__global const unsigned char *in, __global const unsigned int *inOffsets,
+                               __global unsigned char *out, __global const unsigned int *outOffsets,
+                               __global unsigned int *outLengths, const unsigned int n,
+                               __global unsigned int *counters)
+{
+    unsigned int id = get_global_id(0);
+
+    if (id >= n) {
+        return;
+    }
+
+    __global const unsigned char *input = in + (inOffsets[id] - inOffsets[0]);
+    unsigned int inLen = inOffsets[id + 1] - inOffsets[id];
+    __global unsigned char *output = out + (outOffsets[id] - outOffsets[0]);
+    unsigned char slidingWindow[WINDOW_SIZE + WINDOW_MIRROR];
+    unsigned char uncodedLookahead[MAX_CODED];
+    unsigned char encodedData[16];
+    unsigned char flags = 0;
+    unsigned char flagPos = 0x01;
+    int nextEncoded = 0;
+    encoded_string_t matchData;
+    unsigned int read = 0;
+    int len_out = 0;
+    unsigned int i;
+    int len;
+    unsigned int uncodedHead = 0;
+    unsigned int windowHead = 0;
+    unsigned int tokens = 0;
+    unsigned int literals = 0;
+    unsigned long compared = 0;
+    unsigned int longest = 0;
+
+    /* the same known values as EncodeLZSS, mirror included */
+    for (i = 0; i < WINDOW_SIZE + WINDOW_MIRROR; i++) {
+        slidingWindow[i] = ' ';
+    }
+
+    for (len = 0; len < MAX_CODED && read < inLen; len++) {
+        uncodedLookahead[len] = input[read++];
+    }
+
+    if (len == 0) {
+        outLengths[id] = 0;
+        return;
+    }
+
+    matchData = VectorFindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead);
+
+    while (len > 0) {
+        if (matchData.length > len) {
+            /* garbage beyond last data happened to extend match length */
+            matchData.length = len;
+        }
+
+        tokens++;
+        compared += matchData.compared;
+        if (matchData.compared > longest) {
+            longest = matchData.compared;
+        }
+        if (matchData.length <= MAX_UNCODED) {
+            /* not long enough match.  write uncoded flag and character */
+            literals++;
+            matchData.length = 1;
+            flags |= flagPos;
+            encodedData[nextEncoded++] = uncodedLookahead[uncodedHead];
+        } else {
+            encodedData[nextEncoded++] = (unsigned char)((matchData.offset & 0x0FFF) >> 4);
+            encodedData[nextEncoded++] = (unsigned char)(((matchData.offset & 0x000F) << 4) | (matchData.length - (MAX_UNCODED + 1)));
+        }
+
+        if (flagPos == 0x80) {
+            /* we have 8 code flags, write out flags and code buffer */
+            output[len_out++] = flags;
+            for (i = 0; i < nextEncoded; i++) {
+                output[len_out++] = encodedData[i];
+            }
+            flags = 0;
+            flagPos = 0x01;
+            nextEncoded = 0;
+        } else {
+            flagPos <<= 1;
+        }
+
+        /* move the matched bytes into the window and its mirror */
+        for (i = 0; i < matchData.length; i++) {
+            slidingWindow[windowHead] = uncodedLookahead[uncodedHead];
+            if (windowHead < WINDOW_MIRROR) {
+                slidingWindow[windowHead + WINDOW_SIZE] = uncodedLookahead[uncodedHead];
+            }
+            if (read < inLen) {
+                uncodedLookahead[uncodedHead] = input[read++];
+            } else {
+                /* nothing to add to lookahead here */
+                len--;
+            }
+            windowHead = (windowHead + 1) % WINDOW_SIZE;
+            uncodedHead = (uncodedHead + 1) % MAX_CODED;
+        }
+
+        matchData = VectorFindMatch(windowHead, uncodedHead, WINDOW_SIZE, slidingWindow, uncodedLookahead);
+    }
+
+    /* write out any remaining encoded data */
+    if (nextEncoded != 0) {
+        output[len_out++] = flags;
+        for (i = 0; i < nextEncoded; i++) {
+            output[len_out++] = encodedData[i];
+        }
     }
+    outLengths[id] = len_out;
+    CountBlock(counters, tokens, literals, compared, longest);
 }
+#endif
@@ -0,0 +1,33 @@
+/*
+ * The encode kernels compiled for the host, so blocks encoded on CPU
+ * threads come out exactly as the device would have encoded them.
+ */
+#include "hybrid.h"
+#include "clhost.h"
+
+// keep the kernel's names away from the host's
+#define FindMatch KernelFindMatch
+#define EncodeLZSS KernelEncodeLZSS
+#include "encode.cl"
+#undef FindMatch
+#undef EncodeLZSS
+
+/*
+ * A run of one block, offsets are relative to the first block's.  The
+ * group and vector kernels write what EncodeLZSS does, which is quicker
+ * on one thread.
+ */
+void HostEncodeBlock(kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int block)
+{
+    clhost_global_id = 0;
+    if (which == KERNEL_ENCODE_HASH) {
+        EncodeLZSSHash(in->data + in->offsets[block], in->offsets + block,
+            out->data + out->offsets[block], out->offsets + block,
+            out->lengths + block, 1, NULL);
+    } else {
+        KernelEncodeLZSS(in->data + in->offsets[block], in->offsets + block,
+            out->data + out->offsets[block], out->offsets + block,
+            out->lengths + block, 1, NULL);
+    }
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "hybrid.h"
+
+// state shared by the device and the host threads during RunHybrid
+typedef struct hybrid_t
+{
+    cl_engine_t *engine;
+    kernel_id_t which;      // encode kernel the device runs
+    const block_list_t *in;
+    block_list_t *out;
+    int no_of_blocks;
+    int workers;            // host threads plus the device
+    atomic_int next;        // first block nobody has taken yet
+    atomic_int failed;      // set when the device fails, stops everyone
+} hybrid_t;
+
+int DefaultHostThreads(const cl_engine_t *engine)
+{
+    long cpus;
+
+    // a CPU device already has the cores
+    if (engine->type & CL_DEVICE_TYPE_CPU) {
+        return 0;
+    }
+
+    // leave one core to drive the device
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 1) ? (int)cpus - 1 : 0;
+}
+
+// host threads take one block at a time
+static void *HostWorker(void *arg)
+{
+    hybrid_t *h = (hybrid_t *)arg;
+    int block;
+
+    while (!atomic_load(&h->failed)) {
+        block = atomic_fetch_add(&h->next, 1);
+        if (block >= h->no_of_blocks) {
+            break;
+        }
+        HostEncodeBlock(h->which, h->in, h->out, block);
+    }
+
+    return NULL;
+}
+
+/*
+ * The device takes a share of what is left, but at least a block per
+ * compute unit so a launch keeps it busy.  The shares shrink as the end
+ * nears, so the device and the host threads finish close together.
+ */
+static int DeviceWorker(hybrid_t *h)
+{
+    int start, chunk;
+
+    for (;;) {
+        chunk = (h->no_of_blocks - atomic_load(&h->next)) / (2 * h->workers);
+        if (chunk < (int)h->engine->units) {
+            chunk = h->engine->units;
+        }
+
+        start = atomic_fetch_add(&h->next, chunk);
+        if (start >= h->no_of_blocks) {
+            return 0;
+        }
+        if (chunk > h->no_of_blocks - start) {
+            chunk = h->no_of_blocks - start;
+        }
+
+        if (RunKernel(h->engine, h->which, h->in, h->out, start, chunk) != 0) {
+            atomic_store(&h->failed, 1);
+            return -1;
+        }
+    }
+}
+
+int RunHybrid(cl_engine_t *engine, kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int threads)
+{
+    hybrid_t h;
+    pthread_t *tid;
+    int started, result;
+
+    if (threads <= 0) {
+        return RunKernel(engine, which, in, out, 0, in->no_of_blocks);
+    }
+
+    tid = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    if (tid == NULL) {
+        perror("Allocating threads");
+        return -1;
+    }
+
+    h.engine = engine;
+    h.which = which;
+    h.in = in;
+    h.out = out;
+    h.no_of_blocks = in->no_of_blocks;
+    h.workers = threads + 1;
+    atomic_init(&h.next, 0);
+    atomic_init(&h.failed, 0);
+
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&tid[started], NULL, HostWorker, &h) != 0) {
+            break;
+        }
+    }
+
+    result = DeviceWorker(&h);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    free(tid);
+
+    return result;
+}
@@ -0,0 +1,27 @@
+#ifndef _HYBRID_H
+#define _HYBRID_H
+
+#include "clengine.h"
+
+/*
+ * Encodes one block on the calling thread with the code of the encode
+ * kernel which, or of one writing the same bytes.
+ */
+void HostEncodeBlock(kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int block);
+
+// host threads to use next to the engine's device when none are asked for
+int DefaultHostThreads(const cl_engine_t *engine);
+
+/*
+ * Encodes no_of_blocks blocks on the device with the encode kernel which,
+ * and on threads host threads at
+ * the same time.  Each side takes the next blocks from a shared counter
+ * when it is done with its last ones, and writes them to their place in
+ * out, so the output is in order however the blocks were split.  Returns
+ * 0 for success.
+ */
+int RunHybrid(cl_engine_t *engine, kernel_id_t which, const block_list_t *in,
+    block_list_t *out, int threads);
+
+#endif
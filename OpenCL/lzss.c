@@ -1,354 +1,992 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <math.h>
-#include <CL/opencl.h>
-#define WINDOWSIZE 4096
-#define BLOCKSIZE 102400
-#define MAX_UNCODED 2
-#define MAX_CODED ((1 << 4) + MAX_UNCODED)
-#define MAX_SOURCE_SIZE (0x100000)
+#include <limits.h>
+#include "lzss.h"
+#include "clengine.h"
+#include "hybrid.h"
+#include "stream.h"
+#include "tune.h"
+
+/*
+ * Container written by EncodeLZSS: a header of CL_MAGIC, the version byte,
+ * a zero byte, log2 of the window size (0 for WINDOWSIZE), a zero byte,
+ * then block size and block count as 32 bit little endian.
+ * A table of the coded and raw size of every block follows, 32 bits each,
+ * then the coded blocks back to back.  Files starting with the block count
+ * as a length prefixed decimal string are from before the header.
+ *
+ * With CL_FLAG_SUB_BLOCKS in the byte after the version, every block is
+ * split into sub-blocks of 2 to the power of the last header byte, coded
+ * apart and back to back.  The coded size of every sub-block follows the
+ * block table, 32 bits each.
+ */
+#define CL_MAGIC "LZCL"
+#define CL_VERSION 1
+#define CL_FLAG_SUB_BLOCKS 0x01
+#define HEADER_SIZE 16
+#define TABLE_ENTRY_SIZE 8
+#define SUB_ENTRY_SIZE 4
+#define MAX_BLOCK_SIZE (1 << 20)
+#define MIN_SUB_BLOCK_SIZE 512
+
+// set up on the first call and kept for the calls after it
+static cl_engine_t *engine = NULL;
+
+// device chosen by SelectDeviceLZSS, else by $LZSS_CL_DEVICE
+static cl_device_select_t deviceSelect;
+static int deviceSelected = 0;
+
+// host threads encoding next to the device, -1 for $LZSS_CL_THREADS or the default
+static int hostThreads = -1;
+
+// command queues, 0 for $LZSS_CL_QUEUES or the default
+static int queueCount = 0;
+
+// 1 to map batches instead of copying them, -1 for $LZSS_CL_ZEROCOPY or the default
+static int zeroCopy = -1;
+
+// encode kernel, -1 for $LZSS_CL_ENCODER or the default
+static int encoder = -1;
+
+// decode kernel, -1 for $LZSS_CL_DECODER or the default
+static int decoder = -1;
+
+// 1 to count what the kernels do, -1 for $LZSS_CL_COUNTERS
+static int countKernels = -1;
+
+// file each call writes its timings to, NULL for $LZSS_CL_PROFILE
+static char *profilePath = NULL;
+
+// sizes the kernels are built for and block size of files encoded, 0 for the tuned size or BLOCKSIZE
+static kernel_params_t encodeParams = {WINDOWSIZE, MAX_CODED};
+static cl_uint encodeBlockSize = 0;
+
+// settings tuned for the engine's device, a block size of 0 if there are none
+static tune_config_t tuned;
+
+// sub-block size of files encoded, 0 for none
+static cl_uint encodeSubBlockSize = 0;
+
+static const char *GetProfilePath(void)
+{
+    const char *env = getenv("LZSS_CL_PROFILE");
+
+    if (profilePath != NULL)
+    {
+        return (profilePath[0] != '\0') ? profilePath : NULL;
+    }
+    return (env != NULL && env[0] != '\0') ? env : NULL;
+}
 
-typedef struct FIFO
+static cl_engine_t *GetEngine(void)
 {
-    int id;
-    int len;
-    char string[BLOCKSIZE];
-} FIFO;
+    if (engine == NULL)
+    {
+        if (!deviceSelected &&
+            ParseDeviceSelect(getenv("LZSS_CL_DEVICE"), &deviceSelect) != 0)
+        {
+            return NULL;
+        }
+        const char *env = getenv("LZSS_CL_QUEUES");
+        int queues = queueCount;
 
-void callKernel(FIFO *infifo, FIFO *outfifo, int no_of_blocks, char* cl_filename, char* cl_kernelname);
+        if (queues == 0 && env != NULL)
+        {
+            queues = atoi(env);
+        }
+        engine = CreateEngine(&deviceSelect, queues, GetProfilePath() != NULL);
 
-int EncodeLZSS(FILE *fpIn, FILE *fpOut)
+        // a device's work-group sizes apply whatever picked its kernels
+        memset(&tuned, 0, sizeof(tuned));
+        if (engine != NULL && LoadTuneConfig(engine, &tuned) == 0)
+        {
+            printf("Using the settings tuned for this device\n");
+            SetLocalSize(engine, tuned.encoder, tuned.encodeLocalSize);
+            SetLocalSize(engine, tuned.decoder, tuned.decodeLocalSize);
+        }
+    }
+    return engine;
+}
+
+int SelectDeviceLZSS(const char *spec)
 {
-    setbuf(stdout,NULL);
-    if(fpIn == NULL || fpOut == NULL)
+    if (ParseDeviceSelect(spec, &deviceSelect) != 0)
     {
-        printf("No file\n");
-        exit(1);
+        return -1;
     }
-    FIFO *infifo;
-    FIFO *outfifo;
-    fseek(fpIn, 0, SEEK_END);
-    long totalSize = ftell(fpIn);
-    fseek(fpIn, 0, SEEK_SET);
-    if (totalSize < BLOCKSIZE)
+    deviceSelected = 1;
+    ReleaseLZSS();
+    return 0;
+}
+
+int SetQueuesLZSS(int queues)
+{
+    if (queues != 0 && queues != 1 && queues != NUM_QUEUES)
     {
-        printf("No use of parallel GPU computation");
-        return 0;
+        fprintf(stderr, "Queues must be 1 or %d.\n", NUM_QUEUES);
+        return -1;
     }
-    int bsize = BLOCKSIZE;
-    int no_of_blocks = ceil((float)totalSize /(float)bsize);
-    char cblocks[10];
-    sprintf(cblocks, "%d",no_of_blocks);
-    int padding = totalSize % bsize;
-    padding = (padding) ? (bsize - padding) : 0;
-    printf("Num of blocks %d\nBuffer size %d\nTotal Size %ld\n", no_of_blocks, bsize, totalSize);
+    queueCount = queues;
+    ReleaseLZSS();
+    return 0;
+}
+
+int SetZeroCopyLZSS(int on)
+{
+    zeroCopy = (on != 0);
+    return 0;
+}
+
+// the default maps where the device shares the host's memory
+static cl_engine_t *GetMappedEngine(void)
+{
+    const char *env = getenv("LZSS_CL_ZEROCOPY");
+    int on = zeroCopy;
+
+    if (on < 0 && env != NULL && env[0] != '\0')
+    {
+        on = (atoi(env) != 0);
+    }
+    if (on < 0)
+    {
+        on = (engine->type & CL_DEVICE_TYPE_CPU) || engine->unified;
+    }
+    return on ? engine : NULL;
+}
+
+int SetThreadsLZSS(int threads)
+{
+    hostThreads = threads;
+    return 0;
+}
+
+static int GetHostThreads(void)
+{
+    const char *env = getenv("LZSS_CL_THREADS");
+
+    if (hostThreads >= 0)
+    {
+        return hostThreads;
+    }
+    if (env != NULL && env[0] != '\0')
+    {
+        return atoi(env);
+    }
+    return DefaultHostThreads(engine);
+}
+
+int SetEncoderLZSS(const char *name)
+{
+    int which = ParseEncoder(name);
+
+    if (which < 0)
+    {
+        fprintf(stderr, "Unknown encoder %s.\n", name);
+        return -1;
+    }
+    encoder = which;
+    return 0;
+}
+
+void SetCountersLZSS(int on)
+{
+    countKernels = on ? 1 : 0;
+}
+
+static int GetCounting(void)
+{
+    const char *env = getenv("LZSS_CL_COUNTERS");
+
+    if (countKernels >= 0)
+    {
+        return countKernels;
+    }
+    return (env != NULL && atoi(env) != 0);
+}
+
+int SetProfileLZSS(const char *path)
+{
+    char *copy;
+
+    // progress goes to stdout, so the report can't
+    if (path != NULL && strcmp(path, "-") == 0)
+    {
+        fprintf(stderr, "The profile needs a file, stdout has the progress on it.\n");
+        return -1;
+    }
+
+    copy = strdup((path != NULL) ? path : "");
+    if (copy == NULL)
+    {
+        perror("Setting profile");
+        return -1;
+    }
+    free(profilePath);
+    profilePath = copy;
+
+    // profiling is set when the queues are created
+    ReleaseLZSS();
+    return 0;
+}
+
+// writes the timings of the call just made, if asked to
+static void WriteProfile(void)
+{
+    const char *path = GetProfilePath();
+    FILE *fp;
+
+    if (path == NULL)
+    {
+        return;
+    }
+    if (strcmp(path, "-") == 0)
+    {
+        fprintf(stderr, "LZSS_CL_PROFILE needs a file, stdout has the progress on it.\n");
+        return;
+    }
+
+    fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        perror("Opening profile");
+        return;
+    }
+    ReportProfile(engine, fp);
+    fclose(fp);
+}
+
+int SetDecoderLZSS(const char *name)
+{
+    int which = ParseDecoder(name);
+
+    if (which < 0)
+    {
+        fprintf(stderr, "Unknown decoder %s.\n", name);
+        return -1;
+    }
+    decoder = which;
+    return 0;
+}
+
+int SetWindowLZSS(unsigned int size)
+{
+    kernel_params_t params = encodeParams;
+
+    params.windowSize = size;
+    if (CheckKernelParams(&params) != 0)
+    {
+        return -1;
+    }
+    encodeParams = params;
+    return 0;
+}
+
+int SetMaxMatchLZSS(unsigned int length)
+{
+    kernel_params_t params = encodeParams;
+
+    params.maxCoded = length;
+    if (CheckKernelParams(&params) != 0)
+    {
+        return -1;
+    }
+    encodeParams = params;
+    return 0;
+}
 
-    infifo = (FIFO *)malloc(sizeof(FIFO) * no_of_blocks);
-    outfifo = (FIFO *)malloc(sizeof(FIFO) * no_of_blocks);
-    printf("Reading file\n");
-    for (int i = 0; i < no_of_blocks; i++)
+int SetBlockSizeLZSS(unsigned int size)
+{
+    if (size == 0 || size > MAX_BLOCK_SIZE)
+    {
+        fprintf(stderr, "Block size must be from 1 to %d.\n", MAX_BLOCK_SIZE);
+        return -1;
+    }
+    encodeBlockSize = size;
+    return 0;
+}
+
+int SetSubBlockLZSS(unsigned int size)
+{
+    if (size != 0 && (size < MIN_SUB_BLOCK_SIZE || size > MAX_BLOCK_SIZE || (size & (size - 1)) != 0))
+    {
+        fprintf(stderr, "Sub-block size must be a power of 2 from %d to %d.\n",
+            MIN_SUB_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        return -1;
+    }
+    encodeSubBlockSize = size;
+    return 0;
+}
+
+static kernel_id_t GetEncoder(void)
+{
+    const char *env = getenv("LZSS_CL_ENCODER");
+    int which = encoder;
+
+    if (which < 0 && env != NULL && env[0] != '\0')
     {
-        infifo[i].id = i;
-        int result = fread(infifo[i].string, 1, bsize, fpIn);
-        if (result != bsize)
+        which = ParseEncoder(env);
+        if (which < 0)
         {
-            if (i != no_of_blocks - 1)
-            {
-                printf("Reading error1, expected size %d, read size %d ", bsize, result);
-                free(infifo);
-                free(outfifo);
-                exit(3);
-            }
+            fprintf(stderr, "Unknown encoder %s, ignoring it.\n", env);
         }
-        infifo[i].len = result;
-    }
-    for(int i=0; i<no_of_blocks; i++)
-    {
-        printf("%d ", infifo[i].len);
-    }
-    printf("\nCalling Kernel\n");
-    callKernel(infifo, outfifo, no_of_blocks, "encode.cl", "EncodeLZSS");
-    printf("Kernel Completed\n");
-    // write to file
-    //putc((char)no_of_blocks, fpOut);
-    int int_len = strlen(cblocks);
-    int str_len = 0;
-    char temp[8];
-    putc((char)int_len,fpOut);
-    fwrite(cblocks,1, int_len, fpOut);
-    for(int i=0; i<no_of_blocks; i++)
-    {
-        printf("%d ", outfifo[i].len);
-        //putc((char)outfifo[i].len, fpOut);
-        sprintf(temp, "%d",outfifo[i].len);
-        str_len = strlen(temp);
-        putc((char)str_len,fpOut);
-        fwrite(temp, 1, str_len, fpOut);
-        if(i == 0)
+    }
+    if (which < 0)
+    {
+        which = (tuned.blockSize != 0) ? tuned.encoder : KERNEL_ENCODE;
+    }
+    return (kernel_id_t)which;
+}
+
+static kernel_id_t GetDecoder(void)
+{
+    const char *env = getenv("LZSS_CL_DECODER");
+    int which = decoder;
+
+    if (which < 0 && env != NULL && env[0] != '\0')
+    {
+        which = ParseDecoder(env);
+        if (which < 0)
         {
-            printf("Characters written to file are\n");
-            for(int k=0;k<10;k++){
-                printf("%c=%d ", outfifo[i].string[k],outfifo[i].string[k]);
-            }
-            printf("\n");
+            fprintf(stderr, "Unknown decoder %s, ignoring it.\n", env);
         }
-        fwrite(outfifo[i].string, 1, outfifo[i].len, fpOut);
     }
-    printf("\nWrite to file completed\n");
-    // free memory
-    free(infifo);
-    free(outfifo);
+    if (which < 0)
+    {
+        which = (tuned.blockSize != 0) ? tuned.decoder : KERNEL_DECODE;
+    }
+    return (kernel_id_t)which;
 }
 
-int DecodeLZSS(FILE *fpIn, FILE *fpOut)
+// the tuned block size is only used where the sub-blocks divide it
+static cl_uint GetBlockSize(void)
+{
+    if (encodeBlockSize != 0)
+    {
+        return encodeBlockSize;
+    }
+    if (GetEngine() != NULL && tuned.blockSize != 0 && tuned.blockSize <= MAX_BLOCK_SIZE &&
+        (encodeSubBlockSize == 0 || tuned.blockSize % encodeSubBlockSize == 0))
+    {
+        return tuned.blockSize;
+    }
+    return BLOCKSIZE;
+}
+
+int TuneLZSS(FILE *fpIn, unsigned int sampleSize)
+{
+    tune_config_t best;
+    unsigned char *sample;
+    size_t size;
+
+    if (sampleSize == 0)
+    {
+        sampleSize = TUNE_SAMPLE_SIZE;
+    }
+    sample = (unsigned char *)malloc(sampleSize);
+    if (sample == NULL)
+    {
+        perror("Allocating sample");
+        return -1;
+    }
+    size = fread(sample, 1, sampleSize, fpIn);
+    if (size == 0)
+    {
+        fprintf(stderr, "No input to tune on.\n");
+        free(sample);
+        return -1;
+    }
+    printf("Tuning on %zu bytes\n", size);
+
+    if (GetEngine() == NULL || TuneEngine(engine, sample, size, &best, stdout) != 0)
+    {
+        printf("Tuning failed\n");
+        free(sample);
+        return -1;
+    }
+    free(sample);
+
+    tuned = best;
+    return SaveTuneConfig(engine, &best);
+}
+
+int ListDevicesLZSS(FILE *fp)
+{
+    return ListDevices(fp);
+}
+
+void ReleaseLZSS(void)
+{
+    FreeEngine(engine);
+    engine = NULL;
+}
+
+// files and state handed to the stream functions of a call
+typedef struct stream_files_t
+{
+    FILE *fpIn;
+    FILE *fpOut;
+    int threads;            // host threads encoding next to the device
+    kernel_id_t kernel;     // the encode or decode kernel batches run
+    long blocksRead;
+    long blocksRun;
+    long blocksWritten;
+    cl_uint blockSize;
+    cl_uint *table;         // coded and raw size of each block, NULL for old files
+} stream_files_t;
+
+static void PutLE32(unsigned char *p, cl_uint value)
 {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+static cl_uint GetLE32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((cl_uint)p[3] << 24);
+}
+
+static int ReadEncodeBatch(void *arg, block_list_t *in)
+{
+    stream_files_t *files = (stream_files_t *)arg;
+    size_t want = (size_t)in->no_of_blocks * files->blockSize;
+    size_t result = fread(in->data, 1, want, files->fpIn);
+
+    // only the last block of the file may be short
+    if (result <= want - files->blockSize)
+    {
+        printf("Reading error1, expected size %zu, read size %zu ", want, result);
+        return -1;
+    }
+    for (int i = 0; i <= in->no_of_blocks; i++)
+    {
+        in->offsets[i] = (i < in->no_of_blocks) ? (cl_uint)i * files->blockSize : (cl_uint)result;
+    }
+    for (int i = 0; i < in->no_of_blocks; i++)
+    {
+        in->lengths[i] = in->offsets[i + 1] - in->offsets[i];
+    }
+    return 0;
+}
+
+static int RunEncodeBatch(void *arg, const block_list_t *in, block_list_t *out)
+{
+    stream_files_t *files = (stream_files_t *)arg;
+
+    // worst case room for each block
+    for (int i = 0; i <= in->no_of_blocks; i++)
+    {
+        out->offsets[i] = i * ENCODED_BOUND(files->blockSize);
+    }
+    return RunHybrid(engine, files->kernel, in, out, files->threads);
+}
+
+static int WriteEncodeBatch(void *arg, const block_list_t *out)
+{
+    stream_files_t *files = (stream_files_t *)arg;
+
+    for(int i=0; i<out->no_of_blocks; i++)
+    {
+        unsigned char *block = out->data + out->offsets[i];
+        files->table[2 * files->blocksWritten] = out->lengths[i];
+        if (fwrite(block, 1, out->lengths[i], files->fpOut) != out->lengths[i])
+        {
+            perror("Writing output");
+            return -1;
+        }
+        files->blocksWritten++;
+    }
+    return 0;
+}
+
+int EncodeLZSS(FILE *fpIn, FILE *fpOut)
+{
+    setbuf(stdout,NULL);
     if(fpIn == NULL || fpOut == NULL)
     {
         printf("No file\n");
         exit(1);
     }
-    setbuf(stdout,NULL);
-    FIFO *infifo;
-    FIFO *outfifo;
     fseek(fpIn, 0, SEEK_END);
     long totalSize = ftell(fpIn);
     fseek(fpIn, 0, SEEK_SET);
+    if (totalSize < 0)
+    {
+        perror("Input must be a file");
+        return -1;
+    }
 
-    // get the total no of blocks used from the first character of the compressed string
-    int int_len = (int) getc(fpIn);
-    char cblocks[10];
-    fread(cblocks,1,int_len, fpIn);
-    int no_of_blocks = atoi(cblocks);
-    printf("No of blocks %d\ntotalSize %ld\n", no_of_blocks, totalSize);
-    infifo = (FIFO *)malloc(sizeof(FIFO) * no_of_blocks);
-    outfifo = (FIFO *)malloc(sizeof(FIFO) * no_of_blocks);
+    // input shorter than a block is one short block
+    int bsize = GetBlockSize();
+    int no_of_blocks = (totalSize + bsize - 1) / bsize;
+    printf("Num of blocks %d\nBuffer size %d\nTotal Size %ld\n", no_of_blocks, bsize, totalSize);
 
-    int block_no = 0;
-    int c;
-    //printf("Reading file\n");
-    //long totalchars = 0;
-    char temp[8];
-    int length = 0;
-    while(block_no < no_of_blocks)
-    {
-        c = (int) getc(fpIn);
-        //printf("%d=", c);
-        fread(temp, 1, c, fpIn);
-        temp[c] = '\0';
-        length = atoi(temp);
-        //printf("%d ", length);
-        fread(infifo[block_no].string, 1, length, fpIn);
-        infifo[block_no].len = length;
-        infifo[block_no].id = block_no;
-        block_no++;    
-    }
-    //printf("\nTotal characters read %ld\n", totalchars);
-    //printf("\nfile read completed with blocks %d\n", block_no);
-    if(block_no != no_of_blocks)
-    {
-        printf("Some error occurred during Compression\n");
-        free(infifo);
-        free(outfifo);
-        exit(1);
+    // the kernels run on sub-blocks if there are any, whole blocks if not
+    int usize = (encodeSubBlockSize != 0) ? (int)encodeSubBlockSize : bsize;
+    int no_of_units = (totalSize + usize - 1) / usize;
+    if (bsize % usize != 0)
+    {
+        printf("Block size %d isn't a multiple of the sub-block size %d\n", bsize, usize);
+        return -1;
     }
-    printf("Calling kernel\n");
-    callKernel(infifo, outfifo, no_of_blocks, "decode.cl", "DecodeLZSS");
-    printf("Kernel completed\n");
-    // write to file
-    for(int i=0; i<no_of_blocks; i++)
+
+    // the table is filled in once the blocks are written, so seek back to it
+    long start = ftell(fpOut);
+    if (start < 0)
+    {
+        perror("Output must be a file");
+        return -1;
+    }
+
+    if (GetEngine() == NULL || UseKernelParams(engine, &encodeParams) != 0 ||
+        CountKernels(engine, GetCounting()) != 0)
+    {
+        printf("Kernel failed\n");
+        return -1;
+    }
+    ResetProfile(engine);
+
+    size_t tableSize = (size_t)TABLE_ENTRY_SIZE * no_of_blocks;
+    if (usize != bsize)
+    {
+        tableSize += (size_t)SUB_ENTRY_SIZE * no_of_units;
+    }
+    unsigned char *header = (unsigned char *)calloc(HEADER_SIZE + tableSize, 1);
+    cl_uint *table = (cl_uint *)malloc(sizeof(cl_uint) * 2 * no_of_units);
+    if (header == NULL || table == NULL)
+    {
+        perror("Allocating block table");
+        free(header);
+        free(table);
+        return -1;
+    }
+    for (int i = 0; i < no_of_units; i++)
+    {
+        table[2 * i + 1] = (i < no_of_units - 1) ? (cl_uint)usize : (cl_uint)(totalSize - (long)i * usize);
+    }
+    memcpy(header, CL_MAGIC, 4);
+    header[4] = CL_VERSION;
+    for (cl_uint w = encodeParams.windowSize; w > 1; w >>= 1)
+    {
+        header[6]++;
+    }
+    if (usize != bsize)
+    {
+        header[5] = CL_FLAG_SUB_BLOCKS;
+        for (int s = usize; s > 1; s >>= 1)
+        {
+            header[7]++;
+        }
+    }
+    PutLE32(header + 8, bsize);
+    PutLE32(header + 12, no_of_blocks);
+    fwrite(header, 1, HEADER_SIZE + tableSize, fpOut);
+
+    // host threads can't write to buffers the device has unmapped, and
+    // their code is built for the default sizes
+    cl_engine_t *mapped = GetMappedEngine();
+    int threads = (mapped || encodeParams.windowSize != WINDOWSIZE ||
+        encodeParams.maxCoded != MAX_CODED) ? 0 : GetHostThreads();
+    int batch = BATCH_BLOCKS * (bsize / usize);
+    stream_files_t files = {fpIn, fpOut, threads, GetEncoder(), 0, 0, 0, usize, table};
+    stream_t stream = {ReadEncodeBatch, RunEncodeBatch, WriteEncodeBatch,
+        &files, no_of_units, (size_t)batch * usize,
+        (size_t)batch * ENCODED_BOUND(usize), mapped, batch};
+
+    printf("Calling Kernel\n");
+    if (RunStream(&stream) != 0)
+    {
+        printf("Kernel failed\n");
+        free(header);
+        free(table);
+        return -1;
+    }
+
+    // a block's sizes are the sums of its sub-blocks', which follow them
+    unsigned char *entry = header + HEADER_SIZE;
+    for (int i = 0; i < no_of_units; i += bsize / usize)
+    {
+        cl_uint coded = 0, raw = 0;
+        for (int j = i; j < no_of_units && j < i + bsize / usize; j++)
+        {
+            coded += table[2 * j];
+            raw += table[2 * j + 1];
+        }
+        PutLE32(entry, coded);
+        PutLE32(entry + 4, raw);
+        entry += TABLE_ENTRY_SIZE;
+    }
+    for (int i = 0; usize != bsize && i < no_of_units; i++)
+    {
+        PutLE32(entry, table[2 * i]);
+        entry += SUB_ENTRY_SIZE;
+    }
+    if (fseek(fpOut, start + HEADER_SIZE, SEEK_SET) != 0 ||
+        fwrite(header + HEADER_SIZE, 1, tableSize, fpOut) != tableSize ||
+        fseek(fpOut, 0, SEEK_END) != 0)
     {
-        printf("%d ", outfifo[i].len);
-        fwrite(outfifo[i].string, 1, outfifo[i].len, fpOut);
+        perror("Writing block table");
+        free(header);
+        free(table);
+        return -1;
     }
+    free(header);
+    free(table);
     printf("\nWrite to file completed\n");
-    // free memory
-    free(infifo);
-    free(outfifo);
+    ReportOverlap(engine, stdout);
+    if (engine->counters != NULL)
+    {
+        ReportCounters(engine, stdout);
+    }
+    WriteProfile();
+    return 0;
 }
 
-void callKernel(FIFO *infifo, FIFO *outfifo, int no_of_blocks, char* cl_filename, char* cl_kernelname)
+static int ReadDecodeBatch(void *arg, block_list_t *in)
 {
-    FILE *fp;
-    char *source_str;
-    size_t source_size;
-    //printf("Filename %s\nKernelname %s\n",cl_filename,cl_kernelname);
+    stream_files_t *files = (stream_files_t *)arg;
+    char temp[12];
+    long length;
+    cl_uint packed = 0;
+    int c;
 
-    fp = fopen(cl_filename, "r");
-    if (!fp)
+    // the sizes were checked against each other with the table
+    if (files->table != NULL)
     {
-        fprintf(stderr, "Failed to load kernel.\n");
-        exit(1);
+        for (int i = 0; i < in->no_of_blocks; i++)
+        {
+            length = files->table[2 * (files->blocksRead + i)];
+            in->offsets[i] = packed;
+            in->lengths[i] = length;
+            packed += length;
+        }
+        in->offsets[in->no_of_blocks] = packed;
+        files->blocksRead += in->no_of_blocks;
+        if (fread(in->data, 1, packed, files->fpIn) != packed)
+        {
+            printf("Compressed file is truncated\n");
+            return -1;
+        }
+        return 0;
     }
-    source_str = (char *)malloc(MAX_SOURCE_SIZE);
-    source_size = fread(source_str, 1, MAX_SOURCE_SIZE, fp);
-    fclose(fp);
 
-    unsigned int window_size = WINDOWSIZE;
-
-    //device structs
-    cl_mem d_inf;
-    cl_mem d_outf;
+    for (int i = 0; i < in->no_of_blocks; i++)
+    {
+        c = (int) getc(files->fpIn);
+        if (c == EOF || c >= (int)sizeof(temp) ||
+            fread(temp, 1, c, files->fpIn) != (size_t)c)
+        {
+            printf("Some error occurred during Compression\n");
+            return -1;
+        }
+        temp[c] = '\0';
+        length = atol(temp);
+        // no block encodes to more than its bound
+        if (length < 0 || length > ENCODED_BOUND(BLOCKSIZE) ||
+            fread(in->data + packed, 1, length, files->fpIn) != (size_t)length)
+        {
+            printf("Some error occurred during Compression\n");
+            return -1;
+        }
+        in->offsets[i] = packed;
+        in->lengths[i] = length;
+        packed += length;
+    }
+    in->offsets[in->no_of_blocks] = packed;
+    return 0;
+}
 
-    // opencl variables
-    cl_platform_id cpPlatform;
-    cl_device_id dev_id;
-    cl_context context;
-    cl_command_queue queue;
-    cl_program program;
-    cl_kernel kernel;
-    cl_int err;
+static int RunDecodeBatch(void *arg, const block_list_t *in, block_list_t *out)
+{
+    stream_files_t *files = (stream_files_t *)arg;
 
-    size_t bytes = sizeof(FIFO) * no_of_blocks;
-    size_t globalSize;
-    size_t localSize = 256;
-    //globalSize = no_of_blocks * localSize;
-    globalSize = ceil((float)no_of_blocks / (float)localSize) * localSize;
+    // blocks get their raw size, or a whole block in old files
+    out->offsets[0] = 0;
+    for (int i = 0; i < in->no_of_blocks; i++)
+    {
+        out->offsets[i + 1] = out->offsets[i] + ((files->table != NULL) ?
+            files->table[2 * (files->blocksRun + i) + 1] : files->blockSize);
+    }
+    files->blocksRun += in->no_of_blocks;
+    return RunKernel(engine, files->kernel, in, out, 0, in->no_of_blocks);
+}
 
-    err = clGetPlatformIDs(1, &cpPlatform, NULL);
+static int WriteDecodeBatch(void *arg, const block_list_t *out)
+{
+    stream_files_t *files = (stream_files_t *)arg;
 
-    if(err != CL_SUCCESS){
-        perror("Couldn't get platforms\n");
-        return;
+    for(int i=0; i<out->no_of_blocks; i++)
+    {
+        if (files->table != NULL &&
+            out->lengths[i] != files->table[2 * files->blocksWritten + 1])
+        {
+            printf("Block %ld decoded to the wrong size\n", files->blocksWritten);
+            return -1;
+        }
+        if (fwrite(out->data + out->offsets[i], 1, out->lengths[i], files->fpOut) != out->lengths[i])
+        {
+            perror("Writing output");
+            return -1;
+        }
+        files->blocksWritten++;
     }
+    return 0;
+}
 
-    /* Platform Info Start */  
-    cl_platform_info param_name[5] = {CL_PLATFORM_PROFILE,
-                                      CL_PLATFORM_VERSION,
-                                      CL_PLATFORM_NAME,
-                                      CL_PLATFORM_VENDOR, 
-                                      CL_PLATFORM_EXTENSIONS};
-    size_t param_value_size;
+/*
+ * Reads the rest of the header after CL_MAGIC and the block table, and
+ * checks that every size is possible before anything is decoded.
+ */
+static int ReadBlockTable(FILE *fpIn, unsigned char *header, cl_uint **table,
+    cl_uint *blockSize, int *no_of_blocks)
+{
+    unsigned char entry[TABLE_ENTRY_SIZE];
+    cl_uint count;
 
-    printf("\nPlatform ID: %d\n", 1);
-    for(int j = 0; j < 5; ++j) {
-        // Getting size of param.
-        err = clGetPlatformInfo(cpPlatform, param_name[j], 0, NULL, &param_value_size );
-        char *param_value = (char*) malloc(sizeof(char) * param_value_size);
-        // Getting param info.
-        err = clGetPlatformInfo(cpPlatform, param_name[j], param_value_size, param_value,NULL );
-        printf("%s\n", param_value);
-        free(param_value);
+    if (fread(header + 4, 1, HEADER_SIZE - 4, fpIn) != HEADER_SIZE - 4)
+    {
+        printf("Compressed file is truncated\n");
+        return -1;
+    }
+    if (header[4] != CL_VERSION)
+    {
+        printf("Unknown container version %d\n", header[4]);
+        return -1;
     }
-    printf("\n\n");
 
-    err = clGetDeviceIDs(cpPlatform, CL_DEVICE_TYPE_GPU, 1, &dev_id, NULL);
+    *blockSize = GetLE32(header + 8);
+    count = GetLE32(header + 12);
+    if (*blockSize == 0 || *blockSize > MAX_BLOCK_SIZE || count > (cl_uint)INT_MAX / 2)
+    {
+        printf("Bad block size %u or count %u\n", *blockSize, count);
+        return -1;
+    }
 
-    if(err != CL_SUCCESS) {
-        perror("Not able to get device ID\n");
-        printf("Error Code: %d\n", err);
-        return;
+    *table = (cl_uint *)malloc(sizeof(cl_uint) * 2 * (count ? count : 1));
+    if (*table == NULL)
+    {
+        perror("Allocating block table");
+        return -1;
     }
 
-    context = clCreateContext(0, 1, &dev_id, NULL, NULL, &err);
+    for (cl_uint i = 0; i < count; i++)
+    {
+        cl_uint coded, raw;
+
+        if (fread(entry, 1, TABLE_ENTRY_SIZE, fpIn) != TABLE_ENTRY_SIZE)
+        {
+            printf("Compressed file is truncated\n");
+            free(*table);
+            *table = NULL;
+            return -1;
+        }
 
-    if(err != CL_SUCCESS) {
-        perror("Problem creating context\n");
-        printf("Error Code: %d\n", err);
-        return;
+        coded = GetLE32(entry);
+        raw = GetLE32(entry + 4);
+        if (raw > *blockSize || coded > ENCODED_BOUND(raw))
+        {
+            printf("Bad sizes for block %u: %u coded, %u raw\n", i, coded, raw);
+            free(*table);
+            *table = NULL;
+            return -1;
+        }
+        (*table)[2 * i] = coded;
+        (*table)[2 * i + 1] = raw;
     }
 
-    queue = clCreateCommandQueueWithProperties(context, dev_id, NULL, &err);
-    if(err != CL_SUCCESS) {
-        perror("Problem creating command queue\n");
-        printf("Error Code: %d\n", err);
-        return;
+    *no_of_blocks = count;
+    return 0;
+}
+
+/*
+ * Reads the sub-block table after the block table, and replaces the block
+ * table with one of the sub-blocks, which are then run like blocks.  Each
+ * block's sub-blocks are subSize bytes but the last, and their coded sizes
+ * have to add up to the block's.
+ */
+static int ReadSubBlockTable(FILE *fpIn, cl_uint subSize, cl_uint **table,
+    int *no_of_blocks)
+{
+    unsigned char entry[SUB_ENTRY_SIZE];
+    cl_uint *blocks = *table;
+    cl_uint *subs;
+    size_t count = 0;
+    size_t k = 0;
+
+    for (int i = 0; i < *no_of_blocks; i++)
+    {
+        count += (blocks[2 * i + 1] + subSize - 1) / subSize;
+    }
+    if (count > (size_t)INT_MAX / 2)
+    {
+        printf("Bad sub-block count %zu\n", count);
+        return -1;
     }
 
-    program = clCreateProgramWithSource(context, 1, (const char**)&source_str, (const size_t*)&source_size, &err);
-    if(err != CL_SUCCESS) {
-        perror("Problem creating program\n");
-        printf("Error Code: %d\n", err);
-        return;
+    subs = (cl_uint *)malloc(sizeof(cl_uint) * 2 * (count ? count : 1));
+    if (subs == NULL)
+    {
+        perror("Allocating block table");
+        return -1;
     }
 
-    clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if(err != CL_SUCCESS) {
-        perror("Problem building program executable.\n");
-        printf("Error Code: %d\n", err);
-        if(err == CL_BUILD_PROGRAM_FAILURE) {
-            size_t log_siz;
-            clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_siz );
-            char *log = (char *) malloc(log_siz);
-            clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, log_siz, log, NULL);
-            printf("%s\n", log);
+    for (int i = 0; i < *no_of_blocks; i++)
+    {
+        cl_uint sum = 0;
+
+        for (cl_uint left = blocks[2 * i + 1]; left > 0; k++)
+        {
+            cl_uint raw = (left < subSize) ? left : subSize;
+            cl_uint coded;
+
+            if (fread(entry, 1, SUB_ENTRY_SIZE, fpIn) != SUB_ENTRY_SIZE)
+            {
+                printf("Compressed file is truncated\n");
+                free(subs);
+                return -1;
+            }
+            coded = GetLE32(entry);
+            if (coded > ENCODED_BOUND(raw))
+            {
+                printf("Bad sizes for sub-block %zu: %u coded, %u raw\n", k, coded, raw);
+                free(subs);
+                return -1;
+            }
+            subs[2 * k] = coded;
+            subs[2 * k + 1] = raw;
+            sum += coded;
+            left -= raw;
+        }
+        if (sum != blocks[2 * i])
+        {
+            printf("Sub-blocks of block %d don't add up to its %u bytes\n", i, blocks[2 * i]);
+            free(subs);
+            return -1;
         }
-        return;
     }
 
-    size_t len = 0;
-    cl_int ret = CL_SUCCESS;
-    ret = clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-    char *buffer = calloc(len, sizeof(char));
-    ret = clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, len, buffer, NULL);
-    printf("Build info\n%s\n", buffer);
+    free(blocks);
+    *table = subs;
+    *no_of_blocks = count;
+    return 0;
+}
 
-    kernel = clCreateKernel(program, cl_kernelname, &err);
-    if(err != CL_SUCCESS) {
-        perror("Problem creating kernel.\n");
-        printf("Error Code: %d\n", err);
-        return;
+int DecodeLZSS(FILE *fpIn, FILE *fpOut)
+{
+    if(fpIn == NULL || fpOut == NULL)
+    {
+        printf("No file\n");
+        exit(1);
     }
+    setbuf(stdout,NULL);
 
-    d_inf = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &err);
-    if(err != CL_SUCCESS) {
-        perror("Problem creating buffer d_inf.\n");
-        printf("Error Code: %d\n", err);
-        return;
-    }
+    unsigned char header[HEADER_SIZE];
+    cl_uint *table = NULL;
+    cl_uint blockSize = BLOCKSIZE;
+    cl_uint unitSize = BLOCKSIZE;
+    kernel_params_t params = {WINDOWSIZE, MAX_CODED};
+    int no_of_blocks;
 
-    d_outf = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &err);
-    if(err != CL_SUCCESS) {
-        perror("Problem creating buffer d_b.\n");
-        printf("Error Code: %d\n", err);
-        return;
-    }
+    // old files start with the length of the count, never CL_MAGIC[0]
+    int c = getc(fpIn);
+    if (c == CL_MAGIC[0])
+    {
+        header[0] = c;
+        if (fread(header + 1, 1, 3, fpIn) != 3 || memcmp(header, CL_MAGIC, 4) != 0)
+        {
+            printf("Not a compressed file\n");
+            return -1;
+        }
+        if (ReadBlockTable(fpIn, header, &table, &blockSize, &no_of_blocks) != 0)
+        {
+            return -1;
+        }
+        if (header[5] & ~CL_FLAG_SUB_BLOCKS)
+        {
+            printf("Unknown container flags %d\n", header[5]);
+            free(table);
+            return -1;
+        }
 
-    err = clEnqueueWriteBuffer(queue, d_inf, CL_TRUE, 0, bytes, infifo, 0, NULL, NULL);
-    //err |= clEnqueueWriteBuffer(queue, d_outf, CL_TRUE, 0, bytes, outfifo, 0, NULL, NULL);
-    if(err != CL_SUCCESS) {
-        perror("Problem enqueing writes.\n");
-        return;
-    }
+        // the stream runs sub-blocks as its blocks
+        unitSize = blockSize;
+        if (header[5] & CL_FLAG_SUB_BLOCKS)
+        {
+            if (header[7] >= 32 || (1u << header[7]) < MIN_SUB_BLOCK_SIZE ||
+                (1u << header[7]) > blockSize)
+            {
+                printf("Bad sub-block size 2^%d\n", header[7]);
+                free(table);
+                return -1;
+            }
+            unitSize = 1u << header[7];
+            if (ReadSubBlockTable(fpIn, unitSize, &table, &no_of_blocks) != 0)
+            {
+                free(table);
+                return -1;
+            }
+        }
 
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_inf);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_outf);
-    err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &no_of_blocks);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &window_size);
-    //err |= clSetKernelArg(kernel, 4, sizeof(unsigned char)*window_size, NULL);
-    //err |= clSetKernelArg(kernel, 5, sizeof(unsigned char)*MAX_CODED, NULL);
-    if(err != CL_SUCCESS) {
-        perror("Problem setting arguments.\n");
-        printf("Error Code: %d\n", err);
-        return;
+        // an impossible size fails when the kernels are picked
+        if (header[6] != 0)
+        {
+            params.windowSize = (header[6] < 32) ? 1u << header[6] : 0;
+        }
     }
-
-    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &globalSize, &localSize, 0, NULL, NULL);
-    if(err != CL_SUCCESS) {
-        perror("Problem enqueing kernel.\n");
-        printf("Error Code: %d\n", err);
-        return;
+    else
+    {
+        // get the total no of blocks used from the first character of the compressed string
+        int int_len = c;
+        char cblocks[12];
+        if (int_len < 1 || int_len >= (int)sizeof(cblocks) ||
+            fread(cblocks, 1, int_len, fpIn) != (size_t)int_len)
+        {
+            printf("Not a compressed file\n");
+            return -1;
+        }
+        cblocks[int_len] = '\0';
+        no_of_blocks = atoi(cblocks);
+        if (no_of_blocks < 0)
+        {
+            printf("Not a compressed file\n");
+            return -1;
+        }
     }
+    printf("No of blocks %d\n", no_of_blocks);
 
-    err = clFinish(queue);
-    if(err != CL_SUCCESS) {
-        perror("Problem with CL Finish.\n");
-        printf("Error Code: %d\n", err);
-        return;
+    if (GetEngine() == NULL || UseKernelParams(engine, &params) != 0 ||
+        CountKernels(engine, GetCounting()) != 0)
+    {
+        printf("Kernel failed\n");
+        free(table);
+        return -1;
     }
+    ResetProfile(engine);
 
-    clEnqueueReadBuffer(queue, d_outf, CL_TRUE, 0, bytes, outfifo, 0, NULL, NULL);
-    if(err != CL_SUCCESS) {
-        perror("Problem reading from buffer.\n");
-        printf("Error Code: %d\n", err);
-        return;
-    }
+    int batch = BATCH_BLOCKS * (blockSize / unitSize);
+    stream_files_t files = {fpIn, fpOut, 0, GetDecoder(), 0, 0, 0, unitSize, table};
+    stream_t stream = {ReadDecodeBatch, RunDecodeBatch, WriteDecodeBatch,
+        &files, no_of_blocks, (size_t)batch * ENCODED_BOUND(unitSize),
+        (size_t)batch * unitSize, GetMappedEngine(), batch};
 
-    clReleaseMemObject(d_inf);
-    clReleaseMemObject(d_outf);
-    clReleaseProgram(program);
-    clReleaseKernel(kernel);
-    clReleaseCommandQueue(queue);
-    clReleaseContext(context);
+    printf("Calling kernel\n");
+    if (RunStream(&stream) != 0)
+    {
+        printf("Kernel failed\n");
+        free(table);
+        return -1;
+    }
+    free(table);
+    printf("\nWrite to file completed\n");
+    ReportOverlap(engine, stdout);
+    if (engine->counters != NULL)
+    {
+        ReportCounters(engine, stdout);
+    }
+    WriteProfile();
+    return 0;
 }
-
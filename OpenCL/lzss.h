@@ -4,4 +4,105 @@
 int EncodeLZSS(FILE *fpIn, FILE *fpOut);
 int DecodeLZSS(FILE *fpIn, FILE *fpOut);
 
+/* frees the OpenCL setup kept between calls, the next call redoes it */
+void ReleaseLZSS(void);
+
+/*
+ * Picks the OpenCL device by type (gpu, cpu, accelerator, all) and/or
+ * platform[:device] index, e.g. "cpu" or "gpu:0:1".  Overrides
+ * $LZSS_CL_DEVICE.  Returns -1 if spec can't be parsed.
+ */
+int SelectDeviceLZSS(const char *spec);
+
+/*
+ * Number of host threads encoding blocks next to the OpenCL device.
+ * Overrides $LZSS_CL_THREADS, the default is a thread per core but one
+ * for GPUs and none for CPU devices.  0 leaves it all to the device.
+ */
+int SetThreadsLZSS(int threads);
+
+/*
+ * 1 runs transfers and kernels in order on one command queue, 3 gives
+ * writes, kernels and reads their own queues so they overlap.  0, the
+ * default, uses $LZSS_CL_QUEUES, else 3 except on CPU devices.
+ */
+int SetQueuesLZSS(int queues);
+
+/*
+ * Non-zero reads and writes batches in host memory allocated by OpenCL and
+ * mapped, so the device uses it without copies.  The device then encodes
+ * alone.  Overrides $LZSS_CL_ZEROCOPY, the default is on for CPU devices
+ * and devices that share the host's memory.
+ */
+int SetZeroCopyLZSS(int on);
+
+/*
+ * Picks the encode kernel: serial, a work-item per block, group, a
+ * work-group per block, hash, which only tries window positions on a hash
+ * chain, or vector, which compares 16 bytes at a time.  All but hash write
+ * the same output.  Overrides $LZSS_CL_ENCODER, the default is the one
+ * tuned for the device, else serial.  Returns -1 for an unknown name.
+ */
+int SetEncoderLZSS(const char *name);
+
+/*
+ * Picks the decode kernel: serial, a work-item per block, or group, a
+ * work-group per block that decodes a run of flag groups at once.  Both
+ * write the same output.  Overrides $LZSS_CL_DECODER, the default is the
+ * one tuned for the device, else serial.  Returns -1 for an unknown name.
+ */
+int SetDecoderLZSS(const char *name);
+
+/*
+ * Non-zero makes the kernels count tokens, literals, matches and window
+ * bytes compared, and each call prints the counts at the end.  Overrides
+ * $LZSS_CL_COUNTERS, the default is off.
+ */
+void SetCountersLZSS(int on);
+
+/*
+ * Makes each call write what its transfers and kernels took, and the time
+ * creating the context and building programs, as JSON to the file path,
+ * NULL or "" for nowhere.  Overrides $LZSS_CL_PROFILE.  The queues are
+ * profiled from then on, so the next call sets up again.  Returns -1 for
+ * "-", stdout has the progress on it.
+ */
+int SetProfileLZSS(const char *path);
+
+/*
+ * Times the encode kernels but hash, the decode kernels, block sizes and
+ * work-group sizes on the first sampleSize bytes of fpIn, 0 for 8 MB,
+ * and saves the fastest for the device in the tuning file.  Calls after use them for
+ * whatever isn't set otherwise, as do calls in later runs on the same
+ * device and driver.  The file is $LZSS_CL_TUNE, "" for none, else
+ * lzss-opencl/tune.conf under $XDG_CONFIG_HOME or ~/.config.  Returns 0
+ * for success.
+ */
+int TuneLZSS(FILE *fpIn, unsigned int sampleSize);
+
+/*
+ * Sizes for the files encoded after, the kernels are compiled for them.
+ * The window is a power of 2 from 32 to 4096 bytes, and is recorded in the
+ * file for decoding.  The longest match is 3 to 18 bytes, and blocks are
+ * up to 1 MB.  The defaults are 4096, 18 and the block size tuned for
+ * the device, else 102400.  Host threads don't
+ * encode with a window or longest match other than the defaults.  Return
+ * -1 for sizes that aren't possible.
+ */
+int SetWindowLZSS(unsigned int size);
+int SetMaxMatchLZSS(unsigned int length);
+int SetBlockSizeLZSS(unsigned int size);
+
+/*
+ * Splits every block of the files encoded after into sub-blocks of size
+ * bytes, coded apart with their sizes recorded, so the kernels run a
+ * work-item per sub-block.  A power of 2 from 512 bytes to 1 MB that
+ * divides the block size, 0 for none, the default.  Returns -1 for sizes
+ * that aren't possible.
+ */
+int SetSubBlockLZSS(unsigned int size);
+
+/* lists the OpenCL platforms and devices that can be selected */
+int ListDevicesLZSS(FILE *fp);
+
 #endif      
@@ -9,7 +9,8 @@
 typedef enum
 {
     ENCODE,
-    DECODE
+    DECODE,
+    TUNE
 } modes_t;
 
 int main(int argc, char *argv[])
@@ -21,14 +22,17 @@ int main(int argc, char *argv[])
     FILE *fpIn;             /* pointer to open input file */
     FILE *fpOut;            /* pointer to open output file */
     modes_t mode;
+    unsigned int tuneSample;    /* bytes of input to tune on */
+    int result;
 
     /* initialize data */
     fpIn = NULL;
     fpOut = NULL;
     mode = ENCODE;
+    tuneSample = 0;
 
     /* parse command line */
-    optList = GetOptList(argc, argv, "cdi:o:h?");
+    optList = GetOptList(argc, argv, "cdT:i:o:D:t:q:z:e:x:w:m:b:s:kp:lh?");
     thisOpt = optList;
 
     while (thisOpt != NULL)
@@ -43,6 +47,11 @@ int main(int argc, char *argv[])
                 mode = DECODE;
                 break;
 
+            case 'T':       /* tuning mode */
+                mode = TUNE;
+                tuneSample = atoi(thisOpt->argument);
+                break;
+
             case 'i':       /* input file name */
                 if (fpIn != NULL)
                 {
@@ -105,14 +114,208 @@ int main(int argc, char *argv[])
                 }
                 break;
 
+            case 'D':       /* OpenCL device */
+                if (SelectDeviceLZSS(thisOpt->argument) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 't':       /* host threads */
+                SetThreadsLZSS(atoi(thisOpt->argument));
+                break;
+
+            case 'q':       /* command queues */
+                if (SetQueuesLZSS(atoi(thisOpt->argument)) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'z':       /* zero-copy buffers */
+                SetZeroCopyLZSS(atoi(thisOpt->argument));
+                break;
+
+            case 'e':       /* encode kernel */
+                if (SetEncoderLZSS(thisOpt->argument) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'x':       /* decode kernel */
+                if (SetDecoderLZSS(thisOpt->argument) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'w':       /* window size */
+                if (SetWindowLZSS(atoi(thisOpt->argument)) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'm':       /* longest match */
+                if (SetMaxMatchLZSS(atoi(thisOpt->argument)) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'b':       /* block size */
+                if (SetBlockSizeLZSS(atoi(thisOpt->argument)) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 's':       /* sub-block size */
+                if (SetSubBlockLZSS(atoi(thisOpt->argument)) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'k':       /* kernel counters */
+                SetCountersLZSS(1);
+                break;
+
+            case 'p':       /* profile */
+                if (SetProfileLZSS(thisOpt->argument) != 0)
+                {
+                    if (fpIn != NULL)
+                    {
+                        fclose(fpIn);
+                    }
+
+                    if (fpOut != NULL)
+                    {
+                        fclose(fpOut);
+                    }
+
+                    FreeOptList(optList);
+                    return -1;
+                }
+                break;
+
+            case 'l':       /* list OpenCL devices */
+                ListDevicesLZSS(stdout);
+                FreeOptList(optList);
+                return 0;
+
             case 'h':
             case '?':
                 printf("Usage: %s <options>\n\n", FindFileName(argv[0]));
                 printf("options:\n");
                 printf("  -c : Encode input file to output file.\n");
                 printf("  -d : Decode input file to output file.\n");
+                printf("  -T <bytes> : Tune for the device on the start of the input, 0 for 8 MB.\n");
                 printf("  -i <filename> : Name of input file.\n");
                 printf("  -o <filename> : Name of output file.\n");
+                printf("  -D <device> : OpenCL device, gpu, cpu, accelerator or all\n");
+                printf("                and/or platform[:device] index.\n");
+                printf("  -t <threads> : Host threads encoding next to the device.\n");
+                printf("  -q <1|3> : OpenCL command queues, 3 overlaps transfers.\n");
+                printf("  -z <0|1> : Map batches into host memory instead of copying.\n");
+                printf("  -e <serial|group|hash|vector> : OpenCL encode kernel.\n");
+                printf("  -x <serial|group> : OpenCL decode kernel.\n");
+                printf("  -w <bytes> : Window size, a power of 2 from 32 to 4096.\n");
+                printf("  -m <bytes> : Longest match, 3 to 18.\n");
+                printf("  -b <bytes> : Block size, each block is encoded apart.\n");
+                printf("  -s <bytes> : Sub-block size, a work-item each.\n");
+                printf("  -k : Count what the kernels do and print it.\n");
+                printf("  -p <file> : Write the time of each phase to file as JSON.\n");
+                printf("  -l : List OpenCL devices.\n");
                 printf("  -h | ?  : Print out command line options.\n\n");
                 printf("Default: %s -c -i stdin -o stdout\n",
                     FindFileName(argv[0]));
@@ -141,17 +344,22 @@ int main(int argc, char *argv[])
     gettimeofday(&t1_start,0);
     if (mode == ENCODE)
     {
-        EncodeLZSS(fpIn, fpOut);
+        result = EncodeLZSS(fpIn, fpOut);
+    }
+    else if (mode == TUNE)
+    {
+        result = TuneLZSS(fpIn, tuneSample);
     }
     else
     {
-        DecodeLZSS(fpIn, fpOut);
+        result = DecodeLZSS(fpIn, fpOut);
     }
     gettimeofday(&t1_end,0);
+    ReleaseLZSS();
     double alltime = (t1_end.tv_sec-t1_start.tv_sec) + (t1_end.tv_usec - t1_start.tv_usec)/1000000.0;
     printf("\tAll the time took:\t%f \n", alltime);
     /* remember to close files */
     fclose(fpIn);
     fclose(fpOut);
-    return 0;
+    return (result == 0) ? 0 : -1;
 }
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stream.h"
+
+typedef enum
+{
+    SLOT_EMPTY,             // free for the reader
+    SLOT_READ,              // waiting to be run
+    SLOT_DONE               // waiting to be written
+} slot_state_t;
+
+typedef struct ring_t
+{
+    const stream_t *stream;
+    block_list_t in[RING_SLOTS];
+    block_list_t out[RING_SLOTS];
+    slot_state_t state[RING_SLOTS];
+    int batches;            // batches in the stream
+    int failed;             // set by any stage that fails, stops the others
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ring_t;
+
+// waits until slot is in state, returns -1 if a stage failed meanwhile
+static int WaitSlot(ring_t *ring, int slot, slot_state_t state)
+{
+    int result;
+
+    pthread_mutex_lock(&ring->lock);
+    while (ring->state[slot] != state && !ring->failed) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    result = ring->failed ? -1 : 0;
+    pthread_mutex_unlock(&ring->lock);
+    return result;
+}
+
+// moves slot on to state, or marks the stream failed if result isn't 0
+static void SetSlot(ring_t *ring, int slot, slot_state_t state, int result)
+{
+    pthread_mutex_lock(&ring->lock);
+    if (result != 0) {
+        ring->failed = 1;
+    } else {
+        ring->state[slot] = state;
+    }
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static int BatchBlocks(const stream_t *stream)
+{
+    return (stream->batchBlocks > 0) ? stream->batchBlocks : BATCH_BLOCKS;
+}
+
+// batches are read straight into mapped memory when there is an engine
+static int AllocRing(ring_t *ring, int slot)
+{
+    const stream_t *stream = ring->stream;
+    int blocks = BatchBlocks(stream);
+
+    if (stream->mapped != NULL) {
+        return (AllocMappedBlocks(stream->mapped, &ring->in[slot], blocks, stream->inSize) != 0 ||
+            AllocMappedBlocks(stream->mapped, &ring->out[slot], blocks, stream->outSize) != 0) ? -1 : 0;
+    }
+
+    return (AllocBlocks(&ring->in[slot], blocks, stream->inSize) != 0 ||
+        AllocBlocks(&ring->out[slot], blocks, stream->outSize) != 0) ? -1 : 0;
+}
+
+static void FreeRing(ring_t *ring, int slot)
+{
+    if (ring->stream->mapped != NULL) {
+        FreeMappedBlocks(ring->stream->mapped, &ring->in[slot]);
+        FreeMappedBlocks(ring->stream->mapped, &ring->out[slot]);
+    } else {
+        FreeBlocks(&ring->in[slot]);
+        FreeBlocks(&ring->out[slot]);
+    }
+}
+
+static void *Reader(void *arg)
+{
+    ring_t *ring = (ring_t *)arg;
+    const stream_t *stream = ring->stream;
+    int left = stream->no_of_blocks;
+    int blocks = BatchBlocks(stream);
+    int slot, result;
+
+    for (int b = 0; b < ring->batches; b++) {
+        slot = b % RING_SLOTS;
+        if (WaitSlot(ring, slot, SLOT_EMPTY) != 0) {
+            break;
+        }
+
+        ring->in[slot].no_of_blocks = (left < blocks) ? left : blocks;
+        result = stream->read(stream->arg, &ring->in[slot]);
+        left -= ring->in[slot].no_of_blocks;
+        SetSlot(ring, slot, SLOT_READ, result);
+    }
+
+    return NULL;
+}
+
+static void *Writer(void *arg)
+{
+    ring_t *ring = (ring_t *)arg;
+    const stream_t *stream = ring->stream;
+    int slot;
+
+    for (int b = 0; b < ring->batches; b++) {
+        slot = b % RING_SLOTS;
+        if (WaitSlot(ring, slot, SLOT_DONE) != 0) {
+            break;
+        }
+        SetSlot(ring, slot, SLOT_EMPTY, stream->write(stream->arg, &ring->out[slot]));
+    }
+
+    return NULL;
+}
+
+int RunStream(const stream_t *stream)
+{
+    ring_t ring;
+    pthread_t reader, writer;
+    int slot, result = 0;
+
+    memset(&ring, 0, sizeof(ring));
+    ring.stream = stream;
+    ring.batches = (stream->no_of_blocks + BatchBlocks(stream) - 1) / BatchBlocks(stream);
+    ring.failed = 0;
+
+    for (int i = 0; i < RING_SLOTS; i++) {
+        if (AllocRing(&ring, i) != 0) {
+            for (int j = 0; j <= i; j++) {
+                FreeRing(&ring, j);
+            }
+            return -1;
+        }
+        ring.state[i] = SLOT_EMPTY;
+    }
+
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.changed, NULL);
+
+    if (pthread_create(&reader, NULL, Reader, &ring) != 0) {
+        result = -1;
+    } else {
+        if (pthread_create(&writer, NULL, Writer, &ring) != 0) {
+            SetSlot(&ring, 0, SLOT_EMPTY, -1);
+            pthread_join(reader, NULL);
+            result = -1;
+        } else {
+            // batches run on the calling thread, the device was set up on it
+            for (int b = 0; b < ring.batches; b++) {
+                slot = b % RING_SLOTS;
+                if (WaitSlot(&ring, slot, SLOT_READ) != 0) {
+                    break;
+                }
+                ring.out[slot].no_of_blocks = ring.in[slot].no_of_blocks;
+                SetSlot(&ring, slot, SLOT_DONE,
+                    stream->run(stream->arg, &ring.in[slot], &ring.out[slot]));
+            }
+
+            pthread_join(reader, NULL);
+            pthread_join(writer, NULL);
+            result = ring.failed ? -1 : 0;
+        }
+    }
+
+    pthread_cond_destroy(&ring.changed);
+    pthread_mutex_destroy(&ring.lock);
+    for (int i = 0; i < RING_SLOTS; i++) {
+        FreeRing(&ring, i);
+    }
+
+    return result;
+}
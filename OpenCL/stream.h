@@ -0,0 +1,42 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include "clengine.h"
+
+#define BATCH_BLOCKS 256    // blocks run on the device at a time, by default
+#define RING_SLOTS 3        // batches being read, run and written at once
+
+/*
+ * Fills in with the next batch of at most in->no_of_blocks blocks and sets
+ * no_of_blocks to the number read.  Returns 0 for success, -1 for failure.
+ */
+typedef int (*read_batch_t)(void *arg, block_list_t *in);
+
+// runs a batch, out has room for every block of in, returns 0 for success
+typedef int (*run_batch_t)(void *arg, const block_list_t *in, block_list_t *out);
+
+// writes out a finished batch, returns 0 for success
+typedef int (*write_batch_t)(void *arg, const block_list_t *out);
+
+typedef struct stream_t
+{
+    read_batch_t read;
+    run_batch_t run;
+    write_batch_t write;
+    void *arg;              // passed to the three functions
+    int no_of_blocks;       // blocks in the whole stream
+    size_t inSize;          // data bytes for a batch of input
+    size_t outSize;         // data bytes for a batch of output
+    cl_engine_t *mapped;    // engine to map the batches on, NULL to malloc them
+    int batchBlocks;        // blocks in a batch, 0 for BATCH_BLOCKS
+} stream_t;
+
+/*
+ * Runs a stream of blocks a batch at a time through a ring of RING_SLOTS
+ * batches, so memory use doesn't grow with the stream.  Batch N + 1 is
+ * read and batch N - 1 written on their own threads while batch N runs.
+ * Returns 0 for success.
+ */
+int RunStream(const stream_t *stream);
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "tune.h"
+
+#define MAX_PATH_SIZE 1024
+#define MAX_LINE_SIZE 1024
+
+// block sizes tried, those larger than the sample aren't
+static const cl_uint tuneBlockSizes[] = {16384, 32768, 65536, BLOCKSIZE, 262144};
+
+#define NUM_TUNE_BLOCK_SIZES (sizeof(tuneBlockSizes) / sizeof(tuneBlockSizes[0]))
+
+// only those writing the same bytes, hash trades output size for speed and is left to -e
+static const kernel_id_t tuneEncoders[] = {KERNEL_ENCODE, KERNEL_ENCODE_GROUP, KERNEL_ENCODE_VECTOR};
+static const kernel_id_t tuneDecoders[] = {KERNEL_DECODE, KERNEL_DECODE_GROUP};
+
+#define NUM_TUNE_ENCODERS (sizeof(tuneEncoders) / sizeof(tuneEncoders[0]))
+#define NUM_TUNE_DECODERS (sizeof(tuneDecoders) / sizeof(tuneDecoders[0]))
+
+// smallest work-group tried, doubled up to LOCAL_SIZE
+#define TUNE_MIN_LOCAL_SIZE 32
+
+// timed runs of each setting after an untimed one, the fastest counts
+#define TUNE_RUNS 3
+
+static cl_ulong HostTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (cl_ulong)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Runs which over all of in, once to build it and warm up, then
+ * TUNE_RUNS times.  Returns the ns of the fastest, 0 if a run failed.
+ */
+static cl_ulong TimeRuns(cl_engine_t *engine, kernel_id_t which,
+    const block_list_t *in, block_list_t *out)
+{
+    cl_ulong fastest = 0;
+
+    if (RunKernel(engine, which, in, out, 0, in->no_of_blocks) != 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < TUNE_RUNS; i++) {
+        cl_ulong started = HostTime();
+        cl_ulong elapsed;
+
+        if (RunKernel(engine, which, in, out, 0, in->no_of_blocks) != 0) {
+            return 0;
+        }
+        elapsed = HostTime() - started;
+        if (fastest == 0 || elapsed < fastest) {
+            fastest = elapsed;
+        }
+    }
+
+    return fastest ? fastest : 1;
+}
+
+// splits sample into blocks as EncodeLZSS does, with room for them encoded
+static int SplitSample(const unsigned char *sample, size_t size,
+    cl_uint blockSize, block_list_t *in, block_list_t *out)
+{
+    int n = (size + blockSize - 1) / blockSize;
+
+    if (AllocBlocks(in, n, size) != 0) {
+        return -1;
+    }
+    if (AllocBlocks(out, n, (size_t)n * ENCODED_BOUND(blockSize)) != 0) {
+        FreeBlocks(in);
+        return -1;
+    }
+
+    memcpy(in->data, sample, size);
+    for (int i = 0; i <= n; i++) {
+        in->offsets[i] = (i < n) ? (cl_uint)i * blockSize : (cl_uint)size;
+        out->offsets[i] = i * ENCODED_BOUND(blockSize);
+    }
+    for (int i = 0; i < n; i++) {
+        in->lengths[i] = in->offsets[i + 1] - in->offsets[i];
+    }
+
+    return 0;
+}
+
+// packs encoded blocks back to back as DecodeLZSS reads them, with room for them decoded
+static int PackEncoded(const block_list_t *coded, const block_list_t *raw,
+    block_list_t *in, block_list_t *out)
+{
+    int n = coded->no_of_blocks;
+    size_t packed = 0;
+
+    for (int i = 0; i < n; i++) {
+        packed += coded->lengths[i];
+    }
+
+    if (AllocBlocks(in, n, packed) != 0) {
+        return -1;
+    }
+    if (AllocBlocks(out, n, raw->offsets[n]) != 0) {
+        FreeBlocks(in);
+        return -1;
+    }
+
+    packed = 0;
+    for (int i = 0; i < n; i++) {
+        memcpy(in->data + packed, coded->data + coded->offsets[i], coded->lengths[i]);
+        in->offsets[i] = packed;
+        in->lengths[i] = coded->lengths[i];
+        packed += coded->lengths[i];
+    }
+    in->offsets[n] = packed;
+    memcpy(out->offsets, raw->offsets, sizeof(cl_uint) * (n + 1));
+
+    return 0;
+}
+
+/*
+ * Tries every work-group size for which over in, keeping the fastest in
+ * bestTime and bestLocal if it beats them.  Returns -1 if nothing ran.
+ */
+static int SweepLocalSizes(cl_engine_t *engine, kernel_id_t which,
+    const block_list_t *in, block_list_t *out, const char *what,
+    cl_ulong *bestTime, size_t *bestLocal, FILE *fp)
+{
+    size_t size = in->offsets[in->no_of_blocks];
+    int result = -1;
+
+    for (size_t local = TUNE_MIN_LOCAL_SIZE; local <= LOCAL_SIZE; local *= 2) {
+        cl_ulong time;
+        size_t coded = 0;
+
+        SetLocalSize(engine, which, local);
+        time = TimeRuns(engine, which, in, out);
+        if (time == 0) {
+            fprintf(fp, "%s, %zu work-items: failed\n", what, local);
+            continue;
+        }
+
+        for (int i = 0; i < out->no_of_blocks; i++) {
+            coded += out->lengths[i];
+        }
+        // bytes per ns are GB/s
+        fprintf(fp, "%s, %zu work-items: %.1f MB/s, output %.1f%% of the input\n", what, local,
+            (double)size / time * 1000, 100.0 * coded / size);
+
+        result = 0;
+        if (*bestTime == 0 || time < *bestTime) {
+            *bestTime = time;
+            *bestLocal = local;
+        }
+    }
+
+    SetLocalSize(engine, which, 0);
+    return result;
+}
+
+int TuneEngine(cl_engine_t *engine, const unsigned char *sample, size_t size,
+    tune_config_t *best, FILE *fp)
+{
+    block_list_t in, out, coded, raw;
+    cl_ulong encodeTime = 0, decodeTime = 0;
+    char what[64];
+
+    memset(best, 0, sizeof(*best));
+    if (UseKernelParams(engine, NULL) != 0) {
+        return -1;
+    }
+
+    for (size_t b = 0; b < NUM_TUNE_BLOCK_SIZES; b++) {
+        cl_uint blockSize = tuneBlockSizes[b];
+
+        // always try the smallest, however little there is
+        if (b > 0 && blockSize > size) {
+            break;
+        }
+        if (SplitSample(sample, size, blockSize, &in, &out) != 0) {
+            return -1;
+        }
+
+        for (size_t e = 0; e < NUM_TUNE_ENCODERS; e++) {
+            cl_ulong fastest = encodeTime;
+            size_t local = 0;
+
+            snprintf(what, sizeof(what), "Encode %u byte blocks with %s",
+                blockSize, EncoderName(tuneEncoders[e]));
+            if (SweepLocalSizes(engine, tuneEncoders[e], &in, &out, what, &encodeTime, &local, fp) == 0 &&
+                encodeTime != fastest) {
+                best->blockSize = blockSize;
+                best->encoder = tuneEncoders[e];
+                best->encodeLocalSize = local;
+            }
+        }
+
+        FreeBlocks(&in);
+        FreeBlocks(&out);
+    }
+
+    if (encodeTime == 0) {
+        fprintf(stderr, "No encode kernel ran.\n");
+        return -1;
+    }
+
+    // the decoders get what the fastest encoder wrote
+    if (SplitSample(sample, size, best->blockSize, &raw, &coded) != 0) {
+        return -1;
+    }
+    SetLocalSize(engine, best->encoder, best->encodeLocalSize);
+    if (RunKernel(engine, best->encoder, &raw, &coded, 0, raw.no_of_blocks) != 0 ||
+        PackEncoded(&coded, &raw, &in, &out) != 0) {
+        FreeBlocks(&raw);
+        FreeBlocks(&coded);
+        return -1;
+    }
+    FreeBlocks(&coded);
+
+    for (size_t d = 0; d < NUM_TUNE_DECODERS; d++) {
+        cl_ulong time = 0;
+        size_t local = 0;
+
+        snprintf(what, sizeof(what), "Decode %u byte blocks with %s",
+            best->blockSize, DecoderName(tuneDecoders[d]));
+        if (SweepLocalSizes(engine, tuneDecoders[d], &in, &out, what, &time, &local, fp) != 0) {
+            continue;
+        }
+
+        // a decoder that gets it wrong isn't fast
+        if (memcmp(out.data, sample, size) != 0) {
+            fprintf(fp, "%s: output differs from the input\n", what);
+            continue;
+        }
+        if (decodeTime == 0 || time < decodeTime) {
+            decodeTime = time;
+            best->decoder = tuneDecoders[d];
+            best->decodeLocalSize = local;
+        }
+    }
+
+    FreeBlocks(&in);
+    FreeBlocks(&out);
+    FreeBlocks(&raw);
+
+    if (decodeTime == 0) {
+        fprintf(stderr, "No decode kernel ran.\n");
+        return -1;
+    }
+
+    SetLocalSize(engine, best->encoder, best->encodeLocalSize);
+    SetLocalSize(engine, best->decoder, best->decodeLocalSize);
+    fprintf(fp, "Best: %u byte blocks, encode with %s on %zu work-items, decode with %s on %zu\n",
+        best->blockSize, EncoderName(best->encoder), best->encodeLocalSize,
+        DecoderName(best->decoder), best->decodeLocalSize);
+
+    return 0;
+}
+
+/*
+ * Works out the tuning file, making its directory if create is set.
+ * Returns -1 if there is none.
+ */
+static int TunePath(char *path, size_t size, int create)
+{
+    char dir[MAX_PATH_SIZE];
+    const char *env;
+
+    if ((env = getenv("LZSS_CL_TUNE")) != NULL) {
+        if (env[0] == '\0') {
+            return -1;
+        }
+        return (snprintf(path, size, "%s", env) < (int)size) ? 0 : -1;
+    } else if ((env = getenv("XDG_CONFIG_HOME")) != NULL && env[0] != '\0') {
+        if (create) {
+            mkdir(env, 0755);
+        }
+        snprintf(dir, sizeof(dir), "%s/lzss-opencl", env);
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.config", env);
+        if (create) {
+            mkdir(dir, 0755);
+        }
+        snprintf(dir, sizeof(dir), "%s/.config/lzss-opencl", env);
+    } else {
+        return -1;
+    }
+
+    if (create) {
+        mkdir(dir, 0755);
+    }
+    return (snprintf(path, size, "%s/tune.conf", dir) < (int)size) ? 0 : -1;
+}
+
+// makes a device string one field of a line in the tuning file
+static void OneField(char *value)
+{
+    for (char *c = value; *c != '\0'; c++) {
+        if (*c == '\t' || *c == '\n' || *c == '\r') {
+            *c = ' ';
+        }
+    }
+}
+
+/*
+ * The start of the device's line in the tuning file: its name and driver
+ * version, each followed by a tab.
+ */
+static int DeviceKey(cl_engine_t *engine, char *key, size_t size)
+{
+    char *name = GetInfoString(engine, CL_DEVICE_NAME, 0);
+    char *driver = GetInfoString(engine, CL_DRIVER_VERSION, 0);
+    int result = -1;
+
+    if (name != NULL && driver != NULL) {
+        OneField(name);
+        OneField(driver);
+        if (snprintf(key, size, "%s\t%s\t", name, driver) < (int)size) {
+            result = 0;
+        }
+    }
+
+    free(name);
+    free(driver);
+    return result;
+}
+
+int LoadTuneConfig(cl_engine_t *engine, tune_config_t *config)
+{
+    char path[MAX_PATH_SIZE], key[MAX_LINE_SIZE], line[MAX_LINE_SIZE];
+    char encoder[32], decoder[32];
+    unsigned int blockSize, encodeLocal, decodeLocal;
+    int found = -1;
+    FILE *fp;
+
+    if (TunePath(path, sizeof(path), 0) != 0 || DeviceKey(engine, key, sizeof(key)) != 0) {
+        return -1;
+    }
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    // the last line for the device counts
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int e, d;
+
+        if (strncmp(line, key, strlen(key)) != 0 ||
+            sscanf(line + strlen(key), "%u %31s %u %31s %u", &blockSize, encoder,
+                &encodeLocal, decoder, &decodeLocal) != 5) {
+            continue;
+        }
+
+        e = ParseEncoder(encoder);
+        d = ParseDecoder(decoder);
+        if (e < 0 || d < 0 || blockSize == 0 ||
+            encodeLocal > LOCAL_SIZE || (encodeLocal & (encodeLocal - 1)) != 0 ||
+            decodeLocal > LOCAL_SIZE || (decodeLocal & (decodeLocal - 1)) != 0) {
+            fprintf(stderr, "Ignoring a bad line in %s.\n", path);
+            continue;
+        }
+
+        config->blockSize = blockSize;
+        config->encoder = (kernel_id_t)e;
+        config->encodeLocalSize = encodeLocal;
+        config->decoder = (kernel_id_t)d;
+        config->decodeLocalSize = decodeLocal;
+        found = 0;
+    }
+
+    fclose(fp);
+    return found;
+}
+
+int SaveTuneConfig(cl_engine_t *engine, const tune_config_t *config)
+{
+    char path[MAX_PATH_SIZE], temp[MAX_PATH_SIZE + 8];
+    char key[MAX_LINE_SIZE], line[MAX_LINE_SIZE];
+    FILE *fpOld, *fpNew;
+
+    if (TunePath(path, sizeof(path), 1) != 0 || DeviceKey(engine, key, sizeof(key)) != 0) {
+        fprintf(stderr, "No tuning file, set LZSS_CL_TUNE.\n");
+        return -1;
+    }
+
+    // written beside the old file and renamed over it, so a reader sees one or the other
+    snprintf(temp, sizeof(temp), "%s.new", path);
+    fpNew = fopen(temp, "w");
+    if (fpNew == NULL) {
+        perror("Writing tuning file");
+        return -1;
+    }
+
+    fpOld = fopen(path, "r");
+    if (fpOld != NULL) {
+        while (fgets(line, sizeof(line), fpOld) != NULL) {
+            if (strncmp(line, key, strlen(key)) != 0) {
+                fputs(line, fpNew);
+            }
+        }
+        fclose(fpOld);
+    } else {
+        fprintf(fpNew, "# device\tdriver\tblock size\tencoder\twork-items\tdecoder\twork-items\n");
+    }
+
+    fprintf(fpNew, "%s%u\t%s\t%zu\t%s\t%zu\n", key, config->blockSize,
+        EncoderName(config->encoder), config->encodeLocalSize,
+        DecoderName(config->decoder), config->decodeLocalSize);
+
+    if (fclose(fpNew) != 0 || rename(temp, path) != 0) {
+        perror("Writing tuning file");
+        remove(temp);
+        return -1;
+    }
+    printf("Saved to %s\n", path);
+
+    return 0;
+}
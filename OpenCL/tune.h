@@ -0,0 +1,44 @@
+#ifndef _TUNE_H
+#define _TUNE_H
+
+#include <stdio.h>
+#include "clengine.h"
+
+// most of the input the tuner runs on
+#define TUNE_SAMPLE_SIZE (8 << 20)
+
+// the fastest settings found for a device
+typedef struct tune_config_t
+{
+    cl_uint blockSize;
+    kernel_id_t encoder;
+    size_t encodeLocalSize;
+    kernel_id_t decoder;
+    size_t decodeLocalSize;
+} tune_config_t;
+
+/*
+ * Encodes size bytes of sample with every encode kernel but hash, which
+ * writes larger output, at every block size and work-group size.  Then
+ * decodes it with every decode kernel and work-group size at the fastest
+ * block size, and sets best to the fastest of each.  Each is timed on the host from the write to the
+ * read, at the default window and match sizes, and printed to fp.  The
+ * engine is left running the kernels of best at their work-group sizes.
+ * Returns 0 for success.
+ */
+int TuneEngine(cl_engine_t *engine, const unsigned char *sample, size_t size,
+    tune_config_t *best, FILE *fp);
+
+/*
+ * Reads the settings saved for the engine's device and driver version
+ * from the tuning file.  The file is $LZSS_CL_TUNE, or lzss-opencl/tune.conf
+ * under $XDG_CONFIG_HOME or ~/.config, and setting LZSS_CL_TUNE to an
+ * empty string turns tuning files off.  Returns -1 if there is nothing
+ * saved for the device.
+ */
+int LoadTuneConfig(cl_engine_t *engine, tune_config_t *config);
+
+// saves config for the engine's device, replacing what was saved for it
+int SaveTuneConfig(cl_engine_t *engine, const tune_config_t *config);
+
+#endif
@@ -0,0 +1,640 @@
+/***************************************************************************
+*          Lempel, Ziv, Storer, and Szymanski Encoding and Decoding
+*
+*   File    : huffman.c
+*   Purpose : Optional second stage that Huffman codes the literals and
+*             match lengths of an LZSS block with a canonical code built
+*             for that block.  Offsets are still written as plain bits.
+*
+****************************************************************************
+*
+* This file is part of the lzss library.
+*
+* The lzss library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation; either version 3 of the
+* License, or (at your option) any later version.
+*
+* The lzss library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+* General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+***************************************************************************/
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include <string.h>
+#include "huflocal.h"
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* Entry of the decode table, indexed by the next MAX_CODE_LEN bits of the
+* block.  When two literal codes fit in those bits the entry decodes both,
+* which is where most of the speed on text comes from.
+***************************************************************************/
+typedef struct decode_entry_t
+{
+    unsigned short symbol[2];   /* decoded symbols */
+    unsigned char count;        /* number of symbols, 0 for invalid codes */
+    unsigned char bits;         /* bits used by all of the symbols */
+} decode_entry_t;
+
+/* reads bits most significant first from a block held in memory */
+typedef struct bit_reader_t
+{
+    const unsigned char *data;
+    unsigned long size;         /* bytes in data */
+    unsigned long next;         /* index of next byte to load */
+    unsigned long buffer;       /* loaded bits, right justified */
+    unsigned int count;         /* number of bits in buffer */
+} bit_reader_t;
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define TABLE_SIZE      (1 << MAX_CODE_LEN)
+
+/***************************************************************************
+*                            GLOBAL VARIABLES
+***************************************************************************/
+static decode_entry_t decodeTable[TABLE_SIZE];
+
+/***************************************************************************
+*                                FUNCTIONS
+***************************************************************************/
+
+/****************************************************************************
+*   Function   : TokenSymbol
+*   Description: Maps a token to its symbol in the literal/length alphabet.
+*   Parameters : token - literal or match
+*   Effects    : None
+*   Returned   : Symbol coding the literal or the match length
+****************************************************************************/
+static unsigned int TokenSymbol(const lzss_token_t *token)
+{
+    unsigned int base;
+
+    if (token->length == 1)
+    {
+        return token->value;
+    }
+
+    base = token->repeat ? FIRST_REP : NUM_LITERALS;
+
+    if (token->length >= MAX_CODED)
+    {
+        /* escape, the rest of the length follows the code */
+        return base + ESCAPE_CODE;
+    }
+
+    return base + token->length - (MAX_UNCODED + 1);
+}
+
+/****************************************************************************
+*   Function   : BuildLengths
+*   Description: Computes Huffman code lengths for the symbol frequencies
+*                using the two queue method.  If a code would be longer
+*                than MAX_CODE_LEN, the frequencies are flattened and the
+*                tree is rebuilt until every code fits.
+*   Parameters : freq - frequency of each symbol
+*                lengths - receives the code length of each symbol
+*   Effects    : None
+*   Returned   : None
+****************************************************************************/
+static void BuildLengths(const unsigned long *freq, unsigned char *lengths)
+{
+    unsigned long scaled[NUM_SYMBOLS];
+    unsigned long weight[2 * NUM_SYMBOLS];
+    unsigned int parent[2 * NUM_SYMBOLS];
+    unsigned int depth[2 * NUM_SYMBOLS];
+    unsigned int leaves[NUM_SYMBOLS];       /* used symbols by weight */
+    unsigned int n, i, j, leaf, node, next, maxLen, child;
+
+    memcpy(scaled, freq, sizeof(scaled));
+
+    while (1)
+    {
+        n = 0;
+
+        for (i = 0; i < NUM_SYMBOLS; i++)
+        {
+            lengths[i] = 0;
+
+            if (scaled[i] != 0)
+            {
+                /* insertion sort by weight, the alphabet is small */
+                for (j = n; (j > 0) && (scaled[leaves[j - 1]] > scaled[i]); j--)
+                {
+                    leaves[j] = leaves[j - 1];
+                }
+
+                leaves[j] = i;
+                n++;
+            }
+        }
+
+        if (n == 0)
+        {
+            return;
+        }
+
+        if (n == 1)
+        {
+            /* a lone symbol still needs one bit */
+            lengths[leaves[0]] = 1;
+            return;
+        }
+
+        /* leaves are nodes 0 to n - 1, internal nodes follow in order */
+        for (i = 0; i < n; i++)
+        {
+            weight[i] = scaled[leaves[i]];
+        }
+
+        leaf = 0;
+        node = n;
+
+        for (next = n; next < (2 * n) - 1; next++)
+        {
+            weight[next] = 0;
+
+            for (i = 0; i < 2; i++)
+            {
+                if ((leaf < n) &&
+                    ((node >= next) || (weight[leaf] <= weight[node])))
+                {
+                    child = leaf++;
+                }
+                else
+                {
+                    child = node++;
+                }
+
+                parent[child] = next;
+                weight[next] += weight[child];
+            }
+        }
+
+        /* parents always follow their children, so walk down from root */
+        depth[(2 * n) - 2] = 0;
+        maxLen = 0;
+
+        for (i = (2 * n) - 2; i > 0; i--)
+        {
+            depth[i - 1] = depth[parent[i - 1]] + 1;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (depth[i] > maxLen)
+            {
+                maxLen = depth[i];
+            }
+
+            lengths[leaves[i]] = (unsigned char)depth[i];
+        }
+
+        if (maxLen <= MAX_CODE_LEN)
+        {
+            return;
+        }
+
+        for (i = 0; i < NUM_SYMBOLS; i++)
+        {
+            if (scaled[i] != 0)
+            {
+                scaled[i] = (scaled[i] >> 1) | 1;
+            }
+        }
+    }
+}
+
+/****************************************************************************
+*   Function   : AssignCodes
+*   Description: Assigns canonical codes to symbols from their lengths.
+*   Parameters : lengths - code length of each symbol
+*                codes - receives the code of each symbol
+*   Effects    : None
+*   Returned   : 0 for success, -1 if the lengths don't form a prefix code
+****************************************************************************/
+static int AssignCodes(const unsigned char *lengths, unsigned int *codes)
+{
+    unsigned int count[MAX_CODE_LEN + 1];
+    unsigned int nextCode[MAX_CODE_LEN + 1];
+    unsigned int i, code;
+    long left;
+
+    memset(count, 0, sizeof(count));
+
+    for (i = 0; i < NUM_SYMBOLS; i++)
+    {
+        if (lengths[i] > MAX_CODE_LEN)
+        {
+            return -1;
+        }
+
+        count[lengths[i]]++;
+    }
+
+    count[0] = 0;
+    code = 0;
+    left = 1;
+
+    for (i = 1; i <= MAX_CODE_LEN; i++)
+    {
+        /* make sure the code isn't over subscribed */
+        left = (left << 1) - count[i];
+        if (left < 0)
+        {
+            return -1;
+        }
+
+        code = (code + count[i - 1]) << 1;
+        nextCode[i] = code;
+    }
+
+    for (i = 0; i < NUM_SYMBOLS; i++)
+    {
+        if (lengths[i] != 0)
+        {
+            codes[i] = nextCode[lengths[i]]++;
+        }
+        else
+        {
+            codes[i] = 0;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : PutBits
+*   Description: Writes the count low bits of value, most significant
+*                first.
+*   Parameters : bfpOut - bit file to write to
+*                value - bits to write, right justified
+*                count - number of bits to write
+*   Effects    : Bits are written to bfpOut
+*   Returned   : 0 for success, -1 for failure
+****************************************************************************/
+static int PutBits(bit_file_t *bfpOut, const unsigned int value,
+    unsigned int count)
+{
+    while (count > 0)
+    {
+        count--;
+
+        if (BitFilePutBit((value >> count) & 1, bfpOut) == EOF)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : HuffmanPlanBlock
+*   Description: Counts the symbols of a block, builds a canonical code for
+*                them and computes the size of the coded block.
+*   Parameters : tokens - tokens of the block
+*                count - number of tokens
+*                code - receives the code for the block
+*   Effects    : None
+*   Returned   : Number of bits needed for the table and the tokens
+****************************************************************************/
+unsigned long HuffmanPlanBlock(const lzss_token_t *tokens,
+    const unsigned int count, huffman_code_t *code)
+{
+    unsigned long freq[NUM_SYMBOLS];
+    unsigned long bits;
+    unsigned int i;
+
+    memset(freq, 0, sizeof(freq));
+    bits = (unsigned long)NUM_SYMBOLS * CODE_LEN_BITS;
+
+    for (i = 0; i < count; i++)
+    {
+        freq[TokenSymbol(&tokens[i])]++;
+
+        if (tokens[i].length != 1)
+        {
+            bits += ExtendBits(tokens[i].length);
+
+            if (!tokens[i].repeat)
+            {
+                bits += OFFSET_BITS;
+            }
+        }
+    }
+
+    BuildLengths(freq, code->length);
+    AssignCodes(code->length, code->code);
+
+    for (i = 0; i < NUM_SYMBOLS; i++)
+    {
+        bits += freq[i] * code->length[i];
+    }
+
+    return bits;
+}
+
+/****************************************************************************
+*   Function   : HuffmanWriteBlock
+*   Description: Writes the code lengths of the block followed by the coded
+*                tokens.  An escape code is followed by the rest of the
+*                length, then a match code by its offset unless the match
+*                repeats the last distance.
+*   Parameters : bfpOut - bit file to write to
+*                code - code built by HuffmanPlanBlock for these tokens
+*                tokens - tokens of the block
+*                count - number of tokens
+*   Effects    : The coded block is written to bfpOut
+*   Returned   : 0 for success, -1 for failure
+****************************************************************************/
+int HuffmanWriteBlock(bit_file_t *bfpOut, const huffman_code_t *code,
+    const lzss_token_t *tokens, const unsigned int count)
+{
+    unsigned int i, symbol, length;
+
+    for (i = 0; i < NUM_SYMBOLS; i++)
+    {
+        if (PutBits(bfpOut, code->length[i], CODE_LEN_BITS) != 0)
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        symbol = TokenSymbol(&tokens[i]);
+
+        if (PutBits(bfpOut, code->code[symbol], code->length[symbol]) != 0)
+        {
+            return -1;
+        }
+
+        length = tokens[i].length;
+
+        if (length >= LONG_MATCH)
+        {
+            if ((PutBits(bfpOut, LONG_MATCH - MAX_CODED, EXTEND_BITS) != 0) ||
+                (PutBits(bfpOut, length - LONG_MATCH, LONG_EXTEND_BITS) != 0))
+            {
+                return -1;
+            }
+        }
+        else if ((length >= MAX_CODED) &&
+            (PutBits(bfpOut, length - MAX_CODED, EXTEND_BITS) != 0))
+        {
+            return -1;
+        }
+
+        if ((tokens[i].length != 1) && !tokens[i].repeat &&
+            (PutBits(bfpOut, tokens[i].value, OFFSET_BITS) != 0))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : Refill
+*   Description: Loads bytes into the bit reader until it holds more than
+*                24 bits.  Reading past the end of the data yields zeros,
+*                the caller checks for overruns.
+*   Parameters : br - bit reader
+*   Effects    : Bytes are moved from the data into the bit buffer
+*   Returned   : None
+****************************************************************************/
+static void Refill(bit_reader_t *br)
+{
+    while (br->count <= 24)
+    {
+        br->buffer <<= 8;
+
+        if (br->next < br->size)
+        {
+            br->buffer |= br->data[br->next];
+        }
+
+        br->next++;
+        br->count += 8;
+    }
+}
+
+/* peek at the next n bits, there must be at least n bits loaded */
+#define PeekBits(br, n) \
+    (((br)->buffer >> ((br)->count - (n))) & ((1UL << (n)) - 1))
+
+/****************************************************************************
+*   Function   : BuildDecodeTable
+*   Description: Fills decodeTable for the code with the given lengths.
+*                Every MAX_CODE_LEN bit index is first mapped to the symbol
+*                whose code prefixes it.  Literal entries are then extended
+*                with a second literal whenever its code fits in the bits
+*                left over.
+*   Parameters : lengths - code length of each symbol
+*   Effects    : decodeTable is rebuilt
+*   Returned   : 0 for success, -1 if the lengths aren't a prefix code
+****************************************************************************/
+static int BuildDecodeTable(const unsigned char *lengths)
+{
+    unsigned int codes[NUM_SYMBOLS];
+    unsigned int i, j, first, span, len, secondLen;
+    decode_entry_t *entry, *second;
+
+    if (AssignCodes(lengths, codes) != 0)
+    {
+        return -1;
+    }
+
+    memset(decodeTable, 0, sizeof(decodeTable));
+
+    for (i = 0; i < NUM_SYMBOLS; i++)
+    {
+        len = lengths[i];
+        if (len == 0)
+        {
+            continue;
+        }
+
+        first = codes[i] << (MAX_CODE_LEN - len);
+        span = 1U << (MAX_CODE_LEN - len);
+
+        for (j = first; j < first + span; j++)
+        {
+            decodeTable[j].symbol[0] = (unsigned short)i;
+            decodeTable[j].count = 1;
+            decodeTable[j].bits = (unsigned char)len;
+        }
+    }
+
+    /* pair literals, using the code lengths so the order doesn't matter */
+    for (i = 0; i < TABLE_SIZE; i++)
+    {
+        entry = &decodeTable[i];
+        if ((entry->count == 0) || (entry->symbol[0] >= NUM_LITERALS))
+        {
+            continue;
+        }
+
+        len = lengths[entry->symbol[0]];
+        second = &decodeTable[(i << len) & (TABLE_SIZE - 1)];
+
+        if ((second->count == 0) || (second->symbol[0] >= NUM_LITERALS))
+        {
+            continue;
+        }
+
+        secondLen = lengths[second->symbol[0]];
+        if (len + secondLen <= MAX_CODE_LEN)
+        {
+            entry->symbol[1] = second->symbol[0];
+            entry->count = 2;
+            entry->bits = (unsigned char)(len + secondLen);
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : HuffmanReadBlock
+*   Description: Decodes the tokens of a Huffman coded block with a table
+*                lookup per one or two symbols.
+*   Parameters : data - coded block, starting with its code lengths
+*                size - number of bytes in data
+*                tokens - receives the decoded tokens
+*                rawLength - number of bytes the block expands to
+*                version - container version, it decides whether the
+*                          largest length code is an escape
+*   Effects    : decodeTable is rebuilt for the block
+*   Returned   : Number of tokens decoded, or -1 for corrupt data
+****************************************************************************/
+int HuffmanReadBlock(const unsigned char *data, const unsigned long size,
+    lzss_token_t *tokens, const unsigned long rawLength,
+    const unsigned int version)
+{
+    unsigned char lengths[NUM_SYMBOLS];
+    bit_reader_t br;
+    const decode_entry_t *entry;
+    unsigned long produced;
+    unsigned int i, symbol, stored, base;
+    int count;
+
+    br.data = data;
+    br.size = size;
+    br.next = 0;
+    br.buffer = 0;
+    br.count = 0;
+
+    /* blocks older than repeat matches don't have their lengths */
+    stored = (version >= LZSS_VERSION_REP) ? NUM_SYMBOLS : FIRST_REP;
+    memset(lengths, 0, sizeof(lengths));
+
+    for (i = 0; i < stored; i++)
+    {
+        Refill(&br);
+        lengths[i] = (unsigned char)PeekBits(&br, CODE_LEN_BITS);
+        br.count -= CODE_LEN_BITS;
+    }
+
+    if (BuildDecodeTable(lengths) != 0)
+    {
+        return -1;
+    }
+
+    produced = 0;
+    count = 0;
+
+    while (produced < rawLength)
+    {
+        Refill(&br);
+        entry = &decodeTable[PeekBits(&br, MAX_CODE_LEN)];
+
+        if (entry->count == 0)
+        {
+            return -1;
+        }
+
+        br.count -= entry->bits;
+        symbol = entry->symbol[0];
+
+        if (symbol < NUM_LITERALS)
+        {
+            tokens[count].length = 1;
+            tokens[count].value = symbol;
+            count++;
+            produced++;
+
+            if ((entry->count == 2) && (produced < rawLength))
+            {
+                tokens[count].length = 1;
+                tokens[count].value = entry->symbol[1];
+                count++;
+                produced++;
+            }
+        }
+        else
+        {
+            base = (symbol >= FIRST_REP) ? FIRST_REP : NUM_LITERALS;
+            tokens[count].length = symbol - base + MAX_UNCODED + 1;
+
+            if ((version >= LZSS_VERSION_LONG) &&
+                (symbol == base + ESCAPE_CODE))
+            {
+                Refill(&br);
+                tokens[count].length += PeekBits(&br, EXTEND_BITS);
+                br.count -= EXTEND_BITS;
+
+                if (tokens[count].length == LONG_MATCH)
+                {
+                    tokens[count].length += PeekBits(&br, LONG_EXTEND_BITS);
+                    br.count -= LONG_EXTEND_BITS;
+                }
+
+                Refill(&br);
+            }
+
+            tokens[count].repeat = (base == FIRST_REP);
+
+            if (tokens[count].repeat)
+            {
+                tokens[count].value = 0;
+            }
+            else
+            {
+                tokens[count].value = (unsigned int)PeekBits(&br, OFFSET_BITS);
+                br.count -= OFFSET_BITS;
+            }
+
+            produced += tokens[count].length;
+            count++;
+        }
+
+        /* bits used must not run past the end of the data */
+        if ((br.next * 8) - br.count > size * 8)
+        {
+            return -1;
+        }
+    }
+
+    if (produced != rawLength)
+    {
+        return -1;
+    }
+
+    return count;
+}
@@ -0,0 +1,92 @@
+/***************************************************************************
+*          Lempel, Ziv, Storer, and Szymanski Encoding and Decoding
+*
+*   File    : huflocal.h
+*   Purpose : Internal header for the optional Huffman coding of LZSS
+*             blocks.  Contains the prototypes used by lzss.c to entropy
+*             code the tokens of a block.
+*
+****************************************************************************
+*
+* This file is part of the lzss library.
+*
+* The lzss library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public License as
+* published by the Free Software Foundation; either version 3 of the
+* License, or (at your option) any later version.
+*
+* The lzss library is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser
+* General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+***************************************************************************/
+#ifndef _LZSS_HUFFMAN_LOCAL_H
+#define _LZSS_HUFFMAN_LOCAL_H
+
+/***************************************************************************
+*                             INCLUDED FILES
+***************************************************************************/
+#include "lzlocal.h"
+#include "bitfile.h"
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+
+/***************************************************************************
+* Literals and match lengths share one alphabet, as in deflate.  Matches at
+* the last distance have their own lengths, which version 1 and 2 blocks
+* don't have.
+***************************************************************************/
+#define NUM_LITERALS    (UCHAR_MAX + 1)
+#define FIRST_REP       (NUM_LITERALS + (1 << LENGTH_BITS))
+#define NUM_SYMBOLS     (FIRST_REP + (1 << LENGTH_BITS))
+
+/* longest code allowed, it is also the index width of the decode table */
+#define MAX_CODE_LEN    12
+
+/* bits used to store each code length in the block's table */
+#define CODE_LEN_BITS   4
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+
+/***************************************************************************
+* Canonical Huffman code for one block.  Codes are assigned in order of
+* length and then symbol value, so only the lengths need to be stored.
+***************************************************************************/
+typedef struct huffman_code_t
+{
+    unsigned int code[NUM_SYMBOLS];         /* code, right justified */
+    unsigned char length[NUM_SYMBOLS];      /* code length, 0 if unused */
+} huffman_code_t;
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+
+/***************************************************************************
+* HuffmanPlanBlock builds the code for a block of tokens and returns the
+* number of bits HuffmanWriteBlock will write for it, table included.
+*
+* HuffmanWriteBlock returns 0 for success and -1 for failure.
+*
+* HuffmanReadBlock decodes the tokens of a block of size bytes that
+* expands to rawLength bytes and was written for the given container
+* version.  It returns the number of tokens or -1 if the data is corrupt.
+* tokens must have room for rawLength tokens.
+***************************************************************************/
+unsigned long HuffmanPlanBlock(const lzss_token_t *tokens,
+    const unsigned int count, huffman_code_t *code);
+int HuffmanWriteBlock(bit_file_t *bfpOut, const huffman_code_t *code,
+    const lzss_token_t *tokens, const unsigned int count);
+int HuffmanReadBlock(const unsigned char *data, const unsigned long size,
+    lzss_token_t *tokens, const unsigned long rawLength,
+    const unsigned int version);
+
+#endif      /* ndef _LZSS_HUFFMAN_LOCAL_H */
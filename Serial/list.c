@@ -48,7 +48,7 @@
 extern unsigned char slidingWindow[];
 extern unsigned char uncodedLookahead[];
 
-unsigned int lists[UCHAR_MAX];              /* heads of linked lists */
+unsigned int lists[UCHAR_MAX + 1];          /* heads of linked lists */
 unsigned int next[WINDOW_SIZE];             /* indices of next in list */
 
 /***************************************************************************
@@ -59,6 +59,33 @@
 #define ENCODED     0       /* encoded string */
 #define UNCODED     1       /* unencoded character */
 
+#define NEW_OFFSET  0       /* encoded string with its own offset */
+#define REP_OFFSET  1       /* encoded string at the last match distance */
+
+/***************************************************************************
+* Starting with version 2 of the container, the largest length code is an
+* escape.  It is followed by EXTEND_BITS more length bits, and if those are
+* all ones by LONG_EXTEND_BITS more, so a match may be up to MAX_EXTENDED
+* bytes long.
+***************************************************************************/
+#define EXTEND_BITS         8
+#define LONG_EXTEND_BITS    12
+#define ESCAPE_CODE         ((1 << LENGTH_BITS) - 1)
+#define LONG_MATCH          (MAX_CODED + (1 << EXTEND_BITS) - 1)
+#define MAX_EXTENDED        (LONG_MATCH + (1 << LONG_EXTEND_BITS) - 1)
+
+/* container format written by EncodeLZSS (see README) */
+#define LZSS_VERSION        3       /* current container version */
+#define LZSS_VERSION_LONG   2       /* first version with long matches */
+#define LZSS_VERSION_REP    3       /* first version with repeat matches */
+#define LZSS_FLAG_HUFFMAN   0x01    /* blocks may be Huffman coded */
+
+/* maximum number of uncoded bytes in a block */
+#define BLOCK_SIZE      65536
+
+/* upper bound on the coded size of a block that is worth keeping */
+#define MAX_BLOCK_CODED (((BLOCK_SIZE / 8) * 9) + 1)
+
 /***************************************************************************
 *                            TYPE DEFINITIONS
 ***************************************************************************/
@@ -74,6 +101,41 @@ typedef struct encoded_string_t
     unsigned int length;    /* length of longest match */
 } encoded_string_t;
 
+/***************************************************************************
+* Each block of the container starts with a block type byte followed by the
+* number of uncoded bytes and the number of coded bytes as 32 bit little
+* endian values.  Block data always ends on a byte boundary.
+***************************************************************************/
+typedef enum
+{
+    BLOCK_END = 0,          /* no more blocks, nothing follows */
+    BLOCK_LZSS = 1,         /* traditional LZSS flag/offset/length bits */
+    BLOCK_HUFFMAN = 2,      /* Huffman coded literals and lengths */
+    BLOCK_STORED = 3,       /* uncoded bytes, for incompressible data */
+    BLOCK_LZSS_REP = 4      /* LZSS bits with a repeat bit per match */
+} block_type_t;
+
+/***************************************************************************
+* A block is parsed into tokens before it is written, so that the cheapest
+* way of coding the whole block can be chosen.  A literal has a length of
+* 1 and value holds the character, otherwise value holds the offset.
+*
+* The first MAX_CODED bytes of a match are copied from the sliding window
+* as it was before the match.  A longer match continues in the window
+* until it reaches the byte before the match, after that it repeats its
+* own output.
+*
+* A match at the same distance back as the match before it is a repeat.
+* Repeats may be coded without their offset, the decoder works it out from
+* that distance.
+***************************************************************************/
+typedef struct lzss_token_t
+{
+    unsigned int length;    /* 1 for a literal, else length of match */
+    unsigned int value;     /* literal character or offset of match */
+    unsigned int repeat;    /* non-zero for a match at the last distance */
+} lzss_token_t;
+
 /***************************************************************************
 *                                 MACROS
 ***************************************************************************/
@@ -81,6 +143,10 @@ typedef struct encoded_string_t
 #define Wrap(value, limit) \
     (((value) < (limit)) ? (value) : ((value) - (limit)))
 
+/* number of bits following the escape code of a match */
+#define ExtendBits(length) (((length) < MAX_CODED) ? 0 : \
+    (((length) < LONG_MATCH) ? EXTEND_BITS : EXTEND_BITS + LONG_EXTEND_BITS))
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
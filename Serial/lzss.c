@@ -34,9 +34,12 @@
 *                             INCLUDED FILES
 ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include "lzss.h"
 #include "lzlocal.h"
+#include "huflocal.h"
 #include "bitfile.h"
 
 /***************************************************************************
@@ -47,6 +50,17 @@
 *                                CONSTANTS
 ***************************************************************************/
 
+/***************************************************************************
+* The container starts with these magic bytes, a version byte and a flags
+* byte.  Headerless streams written by earlier versions of this library
+* always start with 0x00 (a match against the initial spaces) or a byte of
+* 0x80 or more (an uncoded flag), so the first magic byte tells them apart.
+***************************************************************************/
+static const unsigned char magic[4] = {'L', 'Z', 'S', 'S'};
+
+/* size of the hash table used to look for repeats before parsing */
+#define PROBE_HASH_SIZE     4096
+
 /***************************************************************************
 *                            GLOBAL VARIABLES
 ***************************************************************************/
@@ -54,9 +68,40 @@
 unsigned char slidingWindow[WINDOW_SIZE];
 unsigned char uncodedLookahead[MAX_CODED];
 
+/* last position + 1 of each hashed 3 byte string seen by IsIncompressible */
+static unsigned int probeHash[PROBE_HASH_SIZE];
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
+static int IsIncompressible(const unsigned char *data,
+    const unsigned int size, const unsigned int options,
+    lzss_token_t *tokens, huffman_code_t *code);
+static unsigned int ParseBlock(const unsigned char *data,
+    const unsigned int size, lzss_token_t *tokens, unsigned int *windowHead,
+    unsigned int *lastDistance);
+static unsigned int RepMatchLength(const unsigned int offset,
+    const unsigned int uncodedHead, const unsigned int len);
+static unsigned int ExtendMatch(const unsigned char *data,
+    const unsigned int pos, const unsigned int size,
+    const unsigned int offset, const unsigned int windowHead);
+static void SkipBlock(const unsigned char *data, const unsigned int size,
+    unsigned int *windowHead);
+static int WriteBlock(bit_file_t *bfpOut, const unsigned char *data,
+    const unsigned int rawLength, const lzss_token_t *tokens,
+    const unsigned int count, const unsigned int options,
+    huffman_code_t *code);
+static int WriteStoredBlock(bit_file_t *bfpOut, const unsigned char *data,
+    const unsigned int rawLength);
+static int PutExtension(bit_file_t *bfpOut, const unsigned int length);
+static int ReadLZSSTokens(bit_file_t *bfpIn, lzss_token_t *tokens,
+    const unsigned long rawLength, const unsigned int version,
+    const int repeats);
+static void ExpandTokens(const lzss_token_t *tokens, const unsigned int count,
+    unsigned char *out, unsigned int *nextChar, unsigned int *lastDistance);
+static void StoreBytes(const unsigned char *data, const unsigned int size,
+    unsigned int *nextChar);
+static int DecodeHeaderless(FILE *fpIn, FILE *fpOut);
 
 /***************************************************************************
 *                                FUNCTIONS
@@ -77,15 +122,39 @@ unsigned char uncodedLookahead[MAX_CODED];
 *                event of a failure.
 ****************************************************************************/
 int EncodeLZSS(FILE *fpIn, FILE *fpOut)
+{
+    return EncodeLZSSWithOptions(fpIn, fpOut, 0);
+}
+
+/****************************************************************************
+*   Function   : EncodeLZSSWithOptions
+*   Description: This function will read an input file and write an output
+*                file encoded according to the traditional LZSS algorithm.
+*                The input is encoded in blocks of up to BLOCK_SIZE bytes,
+*                which are preceded by a header that tells how each block
+*                is coded.  Blocks that don't compress are stored as is,
+*                so output grows by at most 9 bytes per block.
+*   Parameters : fpIn - pointer to the open binary file to encode
+*                fpOut - pointer to the open binary file to write encoded
+*                       output
+*                options - LZSS_OPT_* values or'd together
+*   Effects    : fpIn is encoded and written to fpOut.  Neither file is
+*                closed after exit.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+int EncodeLZSSWithOptions(FILE *fpIn, FILE *fpOut,
+    const unsigned int options)
 {
     bit_file_t *bfpOut;
-    encoded_string_t matchData;
-    int c;
-    unsigned int i;
-    unsigned int len;                       /* length of string */
+    unsigned char *block;
+    lzss_token_t *tokens;
+    huffman_code_t *code;
+    unsigned int blockLen, count;
+    int result;
 
-    /* head of sliding window and lookahead */
-    unsigned int windowHead, uncodedHead;
+    /* head of sliding window and last match distance carry over blocks */
+    unsigned int windowHead, lastDistance;
 
     /* validate arguments */
     if ((NULL == fpIn) || (NULL == fpOut))
@@ -94,17 +163,38 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
+    block = (unsigned char *)malloc(BLOCK_SIZE);
+    tokens = (lzss_token_t *)malloc(BLOCK_SIZE * sizeof(lzss_token_t));
+    code = (huffman_code_t *)malloc(sizeof(huffman_code_t));
+
+    if ((NULL == block) || (NULL == tokens) || (NULL == code))
+    {
+        free(block);
+        free(tokens);
+        free(code);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* write the container header before handing fpOut to bitfile */
+    fwrite(magic, 1, sizeof(magic), fpOut);
+    putc(LZSS_VERSION, fpOut);
+    putc((options & LZSS_OPT_HUFFMAN) ? LZSS_FLAG_HUFFMAN : 0, fpOut);
+
     /* convert output file to bitfile */
     bfpOut = MakeBitFile(fpOut, BF_WRITE);
 
     if (NULL == bfpOut)
     {
         perror("Making Output File a BitFile");
+        free(block);
+        free(tokens);
+        free(code);
         return -1;
     }
 
     windowHead = 0;
-    uncodedHead = 0;
+    lastDistance = 1;
 
     /************************************************************************
     * Fill the sliding window buffer with some known vales.  DecodeLZSS must
@@ -113,103 +203,641 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
     ************************************************************************/
     memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
 
+    /* Look for matching string in sliding window */
+    result = InitializeSearchStructures();
+
+    while (0 == result)
+    {
+        blockLen = fread(block, 1, BLOCK_SIZE, fpIn);
+
+        if (0 == blockLen)
+        {
+            break;
+        }
+
+        if (IsIncompressible(block, blockLen, options, tokens, code))
+        {
+            /* don't bother searching for matches that aren't there */
+            SkipBlock(block, blockLen, &windowHead);
+            result = WriteStoredBlock(bfpOut, block, blockLen);
+        }
+        else
+        {
+            count = ParseBlock(block, blockLen, tokens, &windowHead,
+                &lastDistance);
+            result = WriteBlock(bfpOut, block, blockLen, tokens, count,
+                options, code);
+        }
+    }
+
+    BitFilePutChar(BLOCK_END, bfpOut);
+
+    /* we've encoded everything, free bitfile structure */
+    BitFileToFILE(bfpOut);
+
+    free(block);
+    free(tokens);
+    free(code);
+    return result;
+}
+
+/****************************************************************************
+*   Function   : IsIncompressible
+*   Description: This function makes a quick guess at whether a block is
+*                worth parsing.  LZSS only gains on strings of 3 or more
+*                bytes that repeat within the window, so it counts how
+*                often the 3 byte string at each position was seen in the
+*                WINDOW_SIZE bytes before it.  If repeats are rare, the
+*                block could only shrink by Huffman coding its literals,
+*                which is checked directly when that option is set.
+*   Parameters : data - uncoded bytes of the block
+*                size - number of bytes in data
+*                options - LZSS_OPT_* values passed to the encoder
+*                tokens - scratch space for size tokens
+*                code - scratch space for the block's Huffman code
+*   Effects    : None
+*   Returned   : Non-zero if the block should be stored without parsing.
+****************************************************************************/
+static int IsIncompressible(const unsigned char *data,
+    const unsigned int size, const unsigned int options,
+    lzss_token_t *tokens, huffman_code_t *code)
+{
+    unsigned long key;
+    unsigned int i, hash, prev, repeats;
+
+    memset(probeHash, 0, sizeof(probeHash));
+    repeats = 0;
+
+    for (i = 0; i + 2 < size; i++)
+    {
+        key = ((unsigned long)data[i] << 16) |
+            ((unsigned long)data[i + 1] << 8) | data[i + 2];
+        hash = (unsigned int)((key * 2654435761UL) >> 12) &
+            (PROBE_HASH_SIZE - 1);
+        prev = probeHash[hash];
+
+        if ((prev != 0) && (i + 1 - prev <= WINDOW_SIZE) &&
+            (0 == memcmp(data + prev - 1, data + i, 3)))
+        {
+            repeats++;
+        }
+
+        probeHash[hash] = i + 1;
+    }
+
     /************************************************************************
-    * Copy MAX_CODED bytes from the input file into the uncoded lookahead
-    * buffer.
+    * A match saves less than a bit per byte it covers, while every literal
+    * costs an extra bit.  Unless an eighth of the block repeats, plain
+    * LZSS can't beat storing it.
     ************************************************************************/
-    for (len = 0; len < MAX_CODED && (c = getc(fpIn)) != EOF; len++)
+    if (repeats >= size / 8)
     {
-        uncodedLookahead[len] = c;
+        return 0;
     }
 
-    if (0 == len)
+    if (!(options & LZSS_OPT_HUFFMAN))
     {
-        return 0;   /* inFile was empty */
+        return 1;
     }
 
-    /* Look for matching string in sliding window */
-    i = InitializeSearchStructures();
+    for (i = 0; i < size; i++)
+    {
+        tokens[i].length = 1;
+        tokens[i].value = data[i];
+    }
+
+    return (HuffmanPlanBlock(tokens, size, code) / 8 >= size);
+}
+
+/****************************************************************************
+*   Function   : SkipBlock
+*   Description: This function adds the bytes of a block to the sliding
+*                window without looking for matches.
+*   Parameters : data - uncoded bytes of the block
+*                size - number of bytes in data
+*                windowHead - head of sliding window, updated on return
+*   Effects    : The sliding window and search structures are advanced
+*                past the block.
+*   Returned   : None
+****************************************************************************/
+static void SkipBlock(const unsigned char *data, const unsigned int size,
+    unsigned int *windowHead)
+{
+    unsigned int i, head;
+
+    head = *windowHead;
 
-    if (0 != i)
+    for (i = 0; i < size; i++)
     {
-        return i;       /* InitializeSearchStructures returned an error */
+        ReplaceChar(head, data[i]);
+        head = Wrap((head + 1), WINDOW_SIZE);
     }
 
-    matchData = FindMatch(windowHead, uncodedHead);
+    *windowHead = head;
+}
+
+/****************************************************************************
+*   Function   : ParseBlock
+*   Description: This function finds the longest matches for the bytes of
+*                a block and records them as tokens.  The lookahead is only
+*                filled from the block, so the last tokens of a block never
+*                reach into the next one.  The sliding window carries over.
+*   Parameters : data - uncoded bytes of the block
+*                size - number of bytes in data
+*                tokens - receives the literals and matches of the block
+*                windowHead - head of sliding window, updated on return
+*                lastDistance - distance back to the source of the last
+*                               match, updated on return
+*   Effects    : The sliding window and search structures are advanced
+*                past the block.
+*   Returned   : Number of tokens in the block
+****************************************************************************/
+static unsigned int ParseBlock(const unsigned char *data,
+    const unsigned int size, lzss_token_t *tokens, unsigned int *windowHead,
+    unsigned int *lastDistance)
+{
+    encoded_string_t matchData;
+    unsigned int i, read, count;
+    unsigned int len;                       /* length of string */
+    unsigned int distance, repOffset, repLength;
+
+    /* head of sliding window and lookahead */
+    unsigned int head, uncodedHead;
+
+    head = *windowHead;
+    distance = *lastDistance;
+    uncodedHead = 0;
+    read = 0;
+    count = 0;
+
+    /************************************************************************
+    * Copy MAX_CODED bytes from the block into the uncoded lookahead
+    * buffer.
+    ************************************************************************/
+    for (len = 0; len < MAX_CODED && read < size; len++)
+    {
+        uncodedLookahead[len] = data[read++];
+    }
 
-    /* now encoded the rest of the file until an EOF is read */
     while (len > 0)
     {
-        if (matchData.length > len)
+        /* a match at the last distance is cheap to find and to code */
+        repOffset = Wrap((head + WINDOW_SIZE - distance), WINDOW_SIZE);
+        repLength = RepMatchLength(repOffset, uncodedHead, len);
+
+        if (MAX_CODED == repLength)
+        {
+            /* nothing can beat it, skip the search */
+            matchData.offset = repOffset;
+            matchData.length = repLength;
+        }
+        else
+        {
+            matchData = FindMatch(head, uncodedHead);
+
+            if (matchData.length > len)
+            {
+                /* garbage beyond last data happened to extend match length */
+                matchData.length = len;
+            }
+
+            /* on a tie the repeat is cheaper, it may leave out the offset */
+            if ((repLength > MAX_UNCODED) && (repLength >= matchData.length))
+            {
+                matchData.offset = repOffset;
+                matchData.length = repLength;
+            }
+        }
+
+        if ((MAX_CODED == matchData.length) && (MAX_CODED == len))
         {
-            /* garbage beyond last data happened to extend match length */
-            matchData.length = len;
+            /* the whole lookahead matched, see how much further it goes */
+            matchData.length = ExtendMatch(data, read - len, size,
+                matchData.offset, head);
         }
 
         if (matchData.length <= MAX_UNCODED)
         {
-            /* not long enough match.  write uncoded flag and character */
-            BitFilePutBit(UNCODED, bfpOut);
-            BitFilePutChar(uncodedLookahead[uncodedHead], bfpOut);
+            /* not long enough match.  keep the uncoded character */
+            tokens[count].length = 1;
+            tokens[count].value = uncodedLookahead[uncodedHead];
+            tokens[count].repeat = 0;
 
             matchData.length = 1;   /* set to 1 for 1 byte uncoded */
         }
+        else if (matchData.offset == repOffset)
+        {
+            tokens[count].length = matchData.length;
+            tokens[count].value = matchData.offset;
+            tokens[count].repeat = 1;
+        }
         else
         {
-            unsigned int adjustedLen;
+            tokens[count].length = matchData.length;
+            tokens[count].value = matchData.offset;
+            tokens[count].repeat = 0;
 
-            /* adjust the length of the match so minimun encoded len is 0*/
-            adjustedLen = matchData.length - (MAX_UNCODED + 1);
-
-            /* match length > MAX_UNCODED.  Encode as offset and length. */
-            BitFilePutBit(ENCODED, bfpOut);
-            BitFilePutBitsNum(bfpOut, &matchData.offset, OFFSET_BITS,
-                sizeof(unsigned int));
-            BitFilePutBitsNum(bfpOut, &adjustedLen, LENGTH_BITS,
-                sizeof(unsigned int));
+            distance = Wrap((head + WINDOW_SIZE - matchData.offset),
+                WINDOW_SIZE);
+            if (0 == distance)
+            {
+                distance = WINDOW_SIZE;
+            }
         }
 
+        count++;
+
         /********************************************************************
         * Replace the matchData.length worth of bytes we've matched in the
-        * sliding window with new bytes from the input file.
+        * sliding window with new bytes from the block.
         ********************************************************************/
-        i = 0;
-        while ((i < matchData.length) && ((c = getc(fpIn)) != EOF))
+        for (i = 0; i < matchData.length; i++)
         {
             /* add old byte into sliding window and new into lookahead */
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            uncodedLookahead[uncodedHead] = c;
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
+            ReplaceChar(head, uncodedLookahead[uncodedHead]);
+
+            if (read < size)
+            {
+                uncodedLookahead[uncodedHead] = data[read++];
+            }
+            else
+            {
+                /* end of block, nothing to add to lookahead here */
+                len--;
+            }
+
+            head = Wrap((head + 1), WINDOW_SIZE);
             uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            i++;
         }
+    }
+
+    *windowHead = head;
+    *lastDistance = distance;
+    return count;
+}
+
+/****************************************************************************
+*   Function   : RepMatchLength
+*   Description: This function counts how many bytes of the lookahead
+*                match the sliding window at a given offset.
+*   Parameters : offset - sliding window offset to compare against
+*                uncodedHead - head of the uncoded lookahead
+*                len - number of bytes in the lookahead
+*   Effects    : None
+*   Returned   : Length of the match, at most len
+****************************************************************************/
+static unsigned int RepMatchLength(const unsigned int offset,
+    const unsigned int uncodedHead, const unsigned int len)
+{
+    unsigned int i;
 
-        /* handle case where we hit EOF before filling lookahead */
-        while (i < matchData.length)
+    for (i = 0; i < len; i++)
+    {
+        if (slidingWindow[Wrap((offset + i), WINDOW_SIZE)] !=
+            uncodedLookahead[Wrap((uncodedHead + i), MAX_CODED)])
         {
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            /* nothing to add to lookahead here */
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
-            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            len--;
-            i++;
+            break;
         }
+    }
+
+    return i;
+}
 
-        /* find match for the remaining characters */
-        matchData = FindMatch(windowHead, uncodedHead);
+/****************************************************************************
+*   Function   : ExtendMatch
+*   Description: This function continues a match of MAX_CODED bytes past
+*                the end of the lookahead, comparing the block with the
+*                bytes the decoder will copy for a longer match.
+*   Parameters : data - uncoded bytes of the block
+*                pos - index in data of the first byte of the match
+*                size - number of bytes in data
+*                offset - sliding window offset of the match
+*                windowHead - head of sliding window, the match hasn't been
+*                             added to it yet
+*   Effects    : None
+*   Returned   : Length of the match, at most MAX_EXTENDED
+****************************************************************************/
+static unsigned int ExtendMatch(const unsigned char *data,
+    const unsigned int pos, const unsigned int size,
+    const unsigned int offset, const unsigned int windowHead)
+{
+    unsigned int distance, length, limit;
+    unsigned char c;
+
+    /* distance from the start of the match back to its source */
+    distance = Wrap((windowHead + WINDOW_SIZE - offset), WINDOW_SIZE);
+    if (0 == distance)
+    {
+        distance = WINDOW_SIZE;
     }
 
-    /* we've encoded everything, free bitfile structure */
-    BitFileToFILE(bfpOut);
+    limit = size - pos;
+    if (limit > MAX_EXTENDED)
+    {
+        limit = MAX_EXTENDED;
+    }
+
+    for (length = MAX_CODED; length < limit; length++)
+    {
+        if (length < distance)
+        {
+            c = slidingWindow[Wrap((offset + length), WINDOW_SIZE)];
+        }
+        else
+        {
+            /* the match is repeating its own output */
+            c = data[pos + length - distance];
+        }
 
-   return 0;
+        if (c != data[pos + length])
+        {
+            break;
+        }
+    }
+
+    return length;
 }
 
 /****************************************************************************
-*   Function   : DecodeLZSSByFile
+*   Function   : PutBlockHeader
+*   Description: This function writes the type and sizes of a block.
+*   Parameters : bfpOut - pointer to the bit file receiving the block
+*                type - how the block is coded
+*                rawLength - number of bytes the block decodes to
+*                codedLength - number of bytes of block data that follow
+*   Effects    : The block header is written to bfpOut
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+static int PutBlockHeader(bit_file_t *bfpOut, const block_type_t type,
+    const unsigned long rawLength, const unsigned long codedLength)
+{
+    int i;
+
+    if (BitFilePutChar(type, bfpOut) == EOF)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 32; i += 8)
+    {
+        if (BitFilePutChar((rawLength >> i) & 0xFF, bfpOut) == EOF)
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < 32; i += 8)
+    {
+        if (BitFilePutChar((codedLength >> i) & 0xFF, bfpOut) == EOF)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : WriteStoredBlock
+*   Description: This function writes the bytes of a block as they are.
+*   Parameters : bfpOut - pointer to the bit file receiving the block
+*                data - uncoded bytes of the block
+*                rawLength - number of bytes in data
+*   Effects    : The block is written to bfpOut
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+static int WriteStoredBlock(bit_file_t *bfpOut, const unsigned char *data,
+    const unsigned int rawLength)
+{
+    unsigned int i;
+
+    if (PutBlockHeader(bfpOut, BLOCK_STORED, rawLength, rawLength) != 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < rawLength; i++)
+    {
+        if (BitFilePutChar(data[i], bfpOut) == EOF)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : WriteBlock
+*   Description: This function writes the tokens of a block with the
+*                cheapest coding allowed by the options.  If no coding is
+*                smaller than the block itself, the block is stored.
+*                LZSS blocks only spend a bit per match on marking repeats
+*                when leaving out their offsets makes up for it.
+*   Parameters : bfpOut - pointer to the bit file receiving the block
+*                data - uncoded bytes of the block
+*                rawLength - number of bytes in data
+*                tokens - literals and matches of the block
+*                count - number of tokens
+*                options - LZSS_OPT_* values passed to the encoder
+*                code - scratch space for the block's Huffman code
+*   Effects    : The block is written to bfpOut
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+static int WriteBlock(bit_file_t *bfpOut, const unsigned char *data,
+    const unsigned int rawLength, const lzss_token_t *tokens,
+    const unsigned int count, const unsigned int options,
+    huffman_code_t *code)
+{
+    unsigned long lzssBits, repBits, huffmanBits;
+    unsigned int i, offset, adjustedLen;
+    block_type_t type;
+
+    lzssBits = 0;
+    repBits = 0;
+    for (i = 0; i < count; i++)
+    {
+        if (1 == tokens[i].length)
+        {
+            lzssBits += 1 + 8;
+            repBits += 1 + 8;
+            continue;
+        }
+
+        lzssBits += 1 + OFFSET_BITS + LENGTH_BITS +
+            ExtendBits(tokens[i].length);
+        repBits += 2 + LENGTH_BITS + ExtendBits(tokens[i].length);
+
+        if (!tokens[i].repeat)
+        {
+            repBits += OFFSET_BITS;
+        }
+    }
+
+    type = BLOCK_LZSS;
+    if (repBits < lzssBits)
+    {
+        type = BLOCK_LZSS_REP;
+        lzssBits = repBits;
+    }
+
+    huffmanBits = lzssBits;
+    if (options & LZSS_OPT_HUFFMAN)
+    {
+        huffmanBits = HuffmanPlanBlock(tokens, count, code);
+    }
+
+    if (((lzssBits + 7) / 8 >= rawLength) &&
+        ((huffmanBits + 7) / 8 >= rawLength))
+    {
+        return WriteStoredBlock(bfpOut, data, rawLength);
+    }
+
+    if (options & LZSS_OPT_HUFFMAN)
+    {
+        if (huffmanBits < lzssBits)
+        {
+            if ((PutBlockHeader(bfpOut, BLOCK_HUFFMAN, rawLength,
+                (huffmanBits + 7) / 8) != 0) ||
+                (HuffmanWriteBlock(bfpOut, code, tokens, count) != 0))
+            {
+                return -1;
+            }
+
+            BitFileByteAlign(bfpOut);
+            return 0;
+        }
+    }
+
+    if (PutBlockHeader(bfpOut, type, rawLength, (lzssBits + 7) / 8) != 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (1 == tokens[i].length)
+        {
+            /* write uncoded flag and character */
+            BitFilePutBit(UNCODED, bfpOut);
+            BitFilePutChar(tokens[i].value, bfpOut);
+        }
+        else
+        {
+            /* adjust the length of the match so minimun encoded len is 0*/
+            offset = tokens[i].value;
+            adjustedLen = tokens[i].length - (MAX_UNCODED + 1);
+
+            if (adjustedLen > ESCAPE_CODE)
+            {
+                adjustedLen = ESCAPE_CODE;
+            }
+
+            /* match length > MAX_UNCODED.  Encode as offset and length. */
+            BitFilePutBit(ENCODED, bfpOut);
+
+            if (BLOCK_LZSS_REP == type)
+            {
+                BitFilePutBit(tokens[i].repeat ? REP_OFFSET : NEW_OFFSET,
+                    bfpOut);
+            }
+
+            if ((BLOCK_LZSS == type) || !tokens[i].repeat)
+            {
+                BitFilePutBitsNum(bfpOut, &offset, OFFSET_BITS,
+                    sizeof(unsigned int));
+            }
+
+            BitFilePutBitsNum(bfpOut, &adjustedLen, LENGTH_BITS,
+                sizeof(unsigned int));
+
+            if (PutExtension(bfpOut, tokens[i].length) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    BitFileByteAlign(bfpOut);
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : PutExtension
+*   Description: This function writes the length bits that follow the
+*                escape code of a match of MAX_CODED bytes or more.
+*   Parameters : bfpOut - pointer to the bit file receiving the block
+*                length - length of the match
+*   Effects    : The extra length bits, if any, are written to bfpOut
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+static int PutExtension(bit_file_t *bfpOut, const unsigned int length)
+{
+    unsigned int extra, longExtra;
+
+    if (length < MAX_CODED)
+    {
+        return 0;
+    }
+
+    extra = length - MAX_CODED;
+    longExtra = 0;
+
+    if (length >= LONG_MATCH)
+    {
+        /* all ones, the rest of the length follows */
+        extra = LONG_MATCH - MAX_CODED;
+        longExtra = length - LONG_MATCH;
+    }
+
+    if (BitFilePutBitsNum(bfpOut, &extra, EXTEND_BITS,
+        sizeof(unsigned int)) == EOF)
+    {
+        return -1;
+    }
+
+    if ((length >= LONG_MATCH) && (BitFilePutBitsNum(bfpOut, &longExtra,
+        LONG_EXTEND_BITS, sizeof(unsigned int)) == EOF))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : GetLength
+*   Description: This function reads a 32 bit little endian block size.
+*   Parameters : bfpIn - pointer to the bit file being decoded
+*                value - receives the size
+*   Effects    : 4 bytes are read from bfpIn
+*   Returned   : 0 for success, -1 for end of file.
+****************************************************************************/
+static int GetLength(bit_file_t *bfpIn, unsigned long *value)
+{
+    int i, c;
+
+    *value = 0;
+
+    for (i = 0; i < 32; i += 8)
+    {
+        if ((c = BitFileGetChar(bfpIn)) == EOF)
+        {
+            return -1;
+        }
+
+        *value |= (unsigned long)c << i;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : DecodeLZSS
 *   Description: This function will read an LZSS encoded input file and
-*                write an output file.  This algorithm encodes strings as 16
-*                bits (a 12 bit offset + a 4 bit length).
+*                write an output file.  Files written by EncodeLZSS are
+*                decoded block by block.  Headerless files written by
+*                earlier versions of this library are decoded too.
 *   Parameters : fpIn - pointer to the open binary file to decode
 *                fpOut - pointer to the open binary file to write decoded
 *                       output
@@ -221,9 +849,12 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
 int DecodeLZSS(FILE *fpIn, FILE *fpOut)
 {
     bit_file_t *bfpIn;
-    int c;
-    unsigned int i, nextChar;
-    encoded_string_t code;              /* offset/length code for string */
+    unsigned char header[sizeof(magic) + 2];
+    unsigned char *block, *data;
+    lzss_token_t *tokens;
+    unsigned long rawLength, codedLength;
+    unsigned int nextChar, lastDistance;
+    int c, count, result;
 
     /* use stdin if no input file */
     if ((NULL == fpIn) || (NULL == fpOut))
@@ -232,6 +863,399 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
+    if ((c = getc(fpIn)) == EOF)
+    {
+        return 0;   /* inFile was empty */
+    }
+
+    if (c != magic[0])
+    {
+        ungetc(c, fpIn);
+        return DecodeHeaderless(fpIn, fpOut);
+    }
+
+    header[0] = (unsigned char)c;
+
+    if ((fread(header + 1, 1, sizeof(header) - 1, fpIn) !=
+        sizeof(header) - 1) || (memcmp(header, magic, sizeof(magic)) != 0) ||
+        (header[sizeof(magic)] > LZSS_VERSION))
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    block = (unsigned char *)malloc(BLOCK_SIZE);
+    data = (unsigned char *)malloc(MAX_BLOCK_CODED);
+    tokens = (lzss_token_t *)malloc(BLOCK_SIZE * sizeof(lzss_token_t));
+
+    if ((NULL == block) || (NULL == data) || (NULL == tokens))
+    {
+        free(block);
+        free(data);
+        free(tokens);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* convert input file to bitfile */
+    bfpIn = MakeBitFile(fpIn, BF_READ);
+
+    if (NULL == bfpIn)
+    {
+        perror("Making Input File a BitFile");
+        free(block);
+        free(data);
+        free(tokens);
+        return -1;
+    }
+
+    /************************************************************************
+    * Fill the sliding window buffer with some known vales.  EncodeLZSS must
+    * use the same values.  If common characters are used, there's an
+    * increased chance of matching to the earlier strings.
+    ************************************************************************/
+    memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
+
+    nextChar = 0;
+    lastDistance = 1;
+    result = 0;
+
+    while (1)
+    {
+        if ((c = BitFileGetChar(bfpIn)) == BLOCK_END)
+        {
+            break;
+        }
+
+        if ((EOF == c) || (GetLength(bfpIn, &rawLength) != 0) ||
+            (GetLength(bfpIn, &codedLength) != 0) ||
+            (rawLength > BLOCK_SIZE) || (codedLength > MAX_BLOCK_CODED))
+        {
+            result = -1;
+            break;
+        }
+
+        switch (c)
+        {
+            case BLOCK_LZSS:
+            case BLOCK_LZSS_REP:
+                count = ReadLZSSTokens(bfpIn, tokens, rawLength,
+                    header[sizeof(magic)], (BLOCK_LZSS_REP == c));
+                break;
+
+            case BLOCK_HUFFMAN:
+                if (!(header[sizeof(magic) + 1] & LZSS_FLAG_HUFFMAN) ||
+                    (BitFileGetBits(bfpIn, data, codedLength * 8) == EOF))
+                {
+                    count = -1;
+                    break;
+                }
+
+                count = HuffmanReadBlock(data, codedLength, tokens,
+                    rawLength, header[sizeof(magic)]);
+                break;
+
+            case BLOCK_STORED:
+                if ((codedLength != rawLength) ||
+                    (BitFileGetBits(bfpIn, block, rawLength * 8) == EOF))
+                {
+                    count = -1;
+                    break;
+                }
+
+                /* nothing to decode, just keep the window in step */
+                StoreBytes(block, rawLength, &nextChar);
+                fwrite(block, 1, rawLength, fpOut);
+                continue;
+
+            default:
+                count = -1;
+                break;
+        }
+
+        if (count < 0)
+        {
+            result = -1;
+            break;
+        }
+
+        ExpandTokens(tokens, count, block, &nextChar, &lastDistance);
+        fwrite(block, 1, rawLength, fpOut);
+    }
+
+    /* we've decoded everything, free bitfile structure */
+    BitFileToFILE(bfpIn);
+
+    free(block);
+    free(data);
+    free(tokens);
+
+    if (result != 0)
+    {
+        errno = EILSEQ;
+    }
+
+    return result;
+}
+
+/****************************************************************************
+*   Function   : ReadLZSSTokens
+*   Description: This function reads the flag/character and
+*                flag/offset/length codes of a traditional LZSS block.
+*   Parameters : bfpIn - pointer to the bit file being decoded
+*                tokens - receives the literals and matches of the block
+*                rawLength - number of bytes the block decodes to
+*                version - container version, it decides whether the
+*                          largest length code is an escape
+*                repeats - non-zero if each match has a repeat bit
+*   Effects    : The block is read from bfpIn
+*   Returned   : Number of tokens, or -1 if the block is corrupt.
+****************************************************************************/
+static int ReadLZSSTokens(bit_file_t *bfpIn, lzss_token_t *tokens,
+    const unsigned long rawLength, const unsigned int version,
+    const int repeats)
+{
+    encoded_string_t code;              /* offset/length code for string */
+    unsigned int extra;
+    unsigned long produced;
+    int c, count;
+
+    produced = 0;
+    count = 0;
+
+    while (produced < rawLength)
+    {
+        if ((c = BitFileGetBit(bfpIn)) == EOF)
+        {
+            return -1;
+        }
+
+        if (c == UNCODED)
+        {
+            /* uncoded character */
+            if ((c = BitFileGetChar(bfpIn)) == EOF)
+            {
+                return -1;
+            }
+
+            tokens[count].length = 1;
+            tokens[count].value = c;
+        }
+        else
+        {
+            /* offset and length */
+            code.offset = 0;
+            code.length = 0;
+            c = NEW_OFFSET;
+
+            if (repeats && ((c = BitFileGetBit(bfpIn)) == EOF))
+            {
+                return -1;
+            }
+
+            /* a repeat's offset follows from the last match */
+            if ((c != REP_OFFSET) && ((BitFileGetBitsNum(bfpIn,
+                &code.offset, OFFSET_BITS, sizeof(unsigned int))) == EOF))
+            {
+                return -1;
+            }
+
+            if ((BitFileGetBitsNum(bfpIn, &code.length, LENGTH_BITS,
+                sizeof(unsigned int))) == EOF)
+            {
+                return -1;
+            }
+
+            tokens[count].length = code.length + MAX_UNCODED + 1;
+            tokens[count].value = code.offset;
+            tokens[count].repeat = (REP_OFFSET == c);
+
+            if ((version >= LZSS_VERSION_LONG) &&
+                (ESCAPE_CODE == code.length))
+            {
+                extra = 0;
+
+                if (BitFileGetBitsNum(bfpIn, &extra, EXTEND_BITS,
+                    sizeof(unsigned int)) == EOF)
+                {
+                    return -1;
+                }
+
+                tokens[count].length += extra;
+
+                if (tokens[count].length == LONG_MATCH)
+                {
+                    extra = 0;
+
+                    if (BitFileGetBitsNum(bfpIn, &extra, LONG_EXTEND_BITS,
+                        sizeof(unsigned int)) == EOF)
+                    {
+                        return -1;
+                    }
+
+                    tokens[count].length += extra;
+                }
+            }
+        }
+
+        produced += tokens[count].length;
+        count++;
+    }
+
+    /* block data ends on a byte boundary */
+    BitFileByteAlign(bfpIn);
+
+    return (produced == rawLength) ? count : -1;
+}
+
+/****************************************************************************
+*   Function   : ExpandTokens
+*   Description: This function writes the bytes described by the tokens of
+*                a block and adds them to the sliding window.
+*   Parameters : tokens - literals and matches of the block
+*                count - number of tokens
+*                out - receives the decoded bytes
+*                nextChar - sliding window index of the next byte, updated
+*                           on return
+*                lastDistance - distance back to the source of the last
+*                               match, updated on return
+*   Effects    : The sliding window is advanced past the block.
+*   Returned   : None
+****************************************************************************/
+static void ExpandTokens(const lzss_token_t *tokens, const unsigned int count,
+    unsigned char *out, unsigned int *nextChar, unsigned int *lastDistance)
+{
+    unsigned int i, t, length, offset, next, distance, first, part;
+
+    next = *nextChar;
+    distance = *lastDistance;
+
+    for (t = 0; t < count; t++)
+    {
+        length = tokens[t].length;
+
+        if (1 == length)
+        {
+            /* write out byte and put it in sliding window */
+            *out = (unsigned char)tokens[t].value;
+            slidingWindow[next] = *out++;
+            next = Wrap((next + 1), WINDOW_SIZE);
+            continue;
+        }
+
+        /********************************************************************
+        * Copy the whole match out of the window before writing any of it
+        * back, the match may overlap the bytes it replaces.  The output
+        * buffer takes the place of the lookahead.
+        ********************************************************************/
+        offset = tokens[t].value;
+
+        if (tokens[t].repeat)
+        {
+            /* same distance as the last match */
+            offset = Wrap((next + WINDOW_SIZE - distance), WINDOW_SIZE);
+        }
+        else
+        {
+            distance = Wrap((next + WINDOW_SIZE - offset), WINDOW_SIZE);
+            if (0 == distance)
+            {
+                distance = WINDOW_SIZE;
+            }
+        }
+
+        /* the window supplies up to distance or MAX_CODED bytes */
+        first = (distance > MAX_CODED) ? distance : MAX_CODED;
+        if (first > length)
+        {
+            first = length;
+        }
+
+        part = WINDOW_SIZE - offset;
+        if (part > first)
+        {
+            part = first;
+        }
+
+        memcpy(out, slidingWindow + offset, part);
+        memcpy(out + part, slidingWindow, first - part);
+
+        /********************************************************************
+        * The rest of a long match repeats its output every distance bytes.
+        * Copy whole periods at a time, as many as have been written.
+        ********************************************************************/
+        for (i = first; i < length; i += part)
+        {
+            part = ((i - first) / distance + 1) * distance;
+            memcpy(out + i, out + i - part,
+                (length - i < part) ? length - i : part);
+        }
+
+        StoreBytes(out, length, &next);
+        out += length;
+    }
+
+    *nextChar = next;
+    *lastDistance = distance;
+}
+
+/****************************************************************************
+*   Function   : StoreBytes
+*   Description: This function copies the bytes of a stored block into the
+*                sliding window.  Only the last WINDOW_SIZE bytes matter.
+*   Parameters : data - bytes of the block
+*                size - number of bytes in data
+*                nextChar - sliding window index of the next byte, updated
+*                           on return
+*   Effects    : The sliding window is advanced past the block.
+*   Returned   : None
+****************************************************************************/
+static void StoreBytes(const unsigned char *data, const unsigned int size,
+    unsigned int *nextChar)
+{
+    unsigned int count, first;
+
+    count = size;
+    if (count > WINDOW_SIZE)
+    {
+        /* skip the bytes that would be overwritten anyway */
+        *nextChar = (*nextChar + (count - WINDOW_SIZE)) % WINDOW_SIZE;
+        data += count - WINDOW_SIZE;
+        count = WINDOW_SIZE;
+    }
+
+    first = WINDOW_SIZE - *nextChar;
+    if (first > count)
+    {
+        first = count;
+    }
+
+    memcpy(slidingWindow + *nextChar, data, first);
+    memcpy(slidingWindow, data + first, count - first);
+    *nextChar = Wrap((*nextChar + count), WINDOW_SIZE);
+}
+
+/****************************************************************************
+*   Function   : DecodeHeaderless
+*   Description: This function will read a headerless LZSS encoded input
+*                file, as written by earlier versions of this library, and
+*                write an output file.  This algorithm encodes strings as 16
+*                bits (a 12 bit offset + a 4 bit length).
+*   Parameters : fpIn - pointer to the open binary file to decode
+*                fpOut - pointer to the open binary file to write decoded
+*                       output
+*   Effects    : fpIn is decoded and written to fpOut.  Neither file is
+*                closed after exit.
+*   Returned   : 0 for success, -1 for failure.  errno will be set in the
+*                event of a failure.
+****************************************************************************/
+static int DecodeHeaderless(FILE *fpIn, FILE *fpOut)
+{
+    bit_file_t *bfpIn;
+    int c;
+    unsigned int i, nextChar;
+    encoded_string_t code;              /* offset/length code for string */
+
     /* convert input file to bitfile */
     bfpIn = MakeBitFile(fpIn, BF_READ);
 
@@ -33,6 +33,13 @@
 #ifndef _LZSS_H
 #define _LZSS_H
 
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+
+/* options for EncodeLZSSWithOptions, or them together */
+#define LZSS_OPT_HUFFMAN    0x01    /* Huffman code literals and lengths */
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
@@ -47,8 +54,14 @@
 *
 * These functions return 0 for success and -1 for failure.  errno will be
 * set in the event of a failure. 
+*
+* EncodeLZSSWithOptions takes LZSS_OPT_* values that change how blocks are
+* coded.  DecodeLZSS reads the header written by the encoder, so it needs
+* no options.
 ***************************************************************************/
 int EncodeLZSS(FILE *fpIn, FILE *fpOut);
+int EncodeLZSSWithOptions(FILE *fpIn, FILE *fpOut,
+    const unsigned int options);
 int DecodeLZSS(FILE *fpIn, FILE *fpOut);
 
 #endif      /* ndef _LZSS_H */
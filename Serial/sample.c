@@ -82,14 +82,16 @@ int main(int argc, char *argv[])
     FILE *fpIn;             /* pointer to open input file */
     FILE *fpOut;            /* pointer to open output file */
     modes_t mode;
+    unsigned int options;   /* LZSS_OPT_* encoder options */
 
     /* initialize data */
     fpIn = NULL;
     fpOut = NULL;
     mode = ENCODE;
+    options = 0;
 
     /* parse command line */
-    optList = GetOptList(argc, argv, "cdi:o:h?");
+    optList = GetOptList(argc, argv, "cdei:o:h?");
     thisOpt = optList;
 
     while (thisOpt != NULL)
@@ -104,6 +106,10 @@ int main(int argc, char *argv[])
                 mode = DECODE;
                 break;
 
+            case 'e':       /* Huffman code literals and lengths */
+                options |= LZSS_OPT_HUFFMAN;
+                break;
+
             case 'i':       /* input file name */
                 if (fpIn != NULL)
                 {
@@ -172,6 +178,7 @@ int main(int argc, char *argv[])
                 printf("options:\n");
                 printf("  -c : Encode input file to output file.\n");
                 printf("  -d : Decode input file to output file.\n");
+                printf("  -e : Huffman code literals and match lengths.\n");
                 printf("  -i <filename> : Name of input file.\n");
                 printf("  -o <filename> : Name of output file.\n");
                 printf("  -h | ?  : Print out command line options.\n\n");
@@ -201,7 +208,7 @@ int main(int argc, char *argv[])
     /* we have valid parameters encode or decode */
     if (mode == ENCODE)
     {
-        EncodeLZSS(fpIn, fpOut);
+        EncodeLZSSWithOptions(fpIn, fpOut, options);
     }
     else
     {